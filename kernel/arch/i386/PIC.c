@@ -1,6 +1,7 @@
 #include "kernel/PIC.h"
+#include "common/init.h"
 
-void remap_PIC(uint8_t master_offset, uint8_t slave_offset){
+void __init remap_PIC(uint8_t master_offset, uint8_t slave_offset){
 
   // Get current masks
   unsigned char mask_master, mask_slave;
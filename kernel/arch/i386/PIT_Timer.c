@@ -1,6 +1,7 @@
 #include <kernel/PIT_Timer.h>
 #include <common/inline_assembly.h>
 #include <stdio.h>
+#include <common/init.h>
 
 static void send_command(uint8_t command){
   outb(COMMAND_REGISTER, command);
@@ -10,7 +11,7 @@ static void send_data(uint8_t data){
   outb(CHANNEL0_DATA_PORT, data);
 }
 
-void initialize_PIT_timer(uint32_t frequency){
+void __init initialize_PIT_timer(uint32_t frequency){
 
   uint32_t divisor = PIT_INPUT_FREQ / frequency;
 
@@ -0,0 +1,229 @@
+#include <kernel/balloon.h>
+#include <kernel/virtio.h>
+#include <kernel/pmm.h>
+#include <kernel/vmm.h>
+#include <kernel/sleep.h>
+#include <kernel/multitasking.h>
+#include <string.h>
+#include <stdio.h>
+
+static virtio_device_t balloon_dev;
+static virtqueue_t inflate_vq;
+static virtqueue_t deflate_vq;
+static virtqueue_t stats_vq;
+static uint32_t features = 0;
+static uint8_t balloon_present = 0;
+
+// Set while the balloon is being resized; the OOM path must not re-enter
+static uint8_t balloon_busy = 0;
+
+// Frames in the balloon, most recent last
+static uint32_t balloon_frames[BALLOON_MAX_PAGES];
+static balloon_stats_t stats;
+
+// DMA buffers. Aligned so neither crosses a page boundary
+static uint32_t pfns[BALLOON_ARRAY_PFNS] __attribute__((aligned(1024)));
+static balloon_stat_t stat_buffer[BALLOON_NUM_STATS] __attribute__((aligned(64)));
+
+// ----------------------------------------
+// Inflate / Deflate
+// ----------------------------------------
+
+// Hand up to count free frames to the host. Returns how many went
+static uint32_t inflate(uint32_t count){
+  if (count > BALLOON_ARRAY_PFNS){
+    count = BALLOON_ARRAY_PFNS;
+  }
+  if (count > BALLOON_MAX_PAGES - stats.held){
+    count = BALLOON_MAX_PAGES - stats.held;
+  }
+
+  // Only ever from memory that's really free
+  uint32_t free = count_free_frames();
+  if (free <= BALLOON_MIN_FREE){
+    return 0;
+  }
+  if (count > free - BALLOON_MIN_FREE){
+    count = free - BALLOON_MIN_FREE;
+  }
+
+  uint32_t got = alloc_frames(pfns, count, 1);
+  if (!got){
+    return 0;
+  }
+
+  int sent = virtqueue_transfer(&balloon_dev, &inflate_vq, (uint32_t)virt_to_phys(pfns), got * sizeof(uint32_t), 0);
+  if (!sent){
+    free_frames(pfns, got);
+    return 0;
+  }
+
+  // Timed out, the host may still take these pages: they stay in the
+  // balloon either way. Stop there rather than reuse pfns under it
+  memcpy(&balloon_frames[stats.held], pfns, got * sizeof(uint32_t));
+  stats.held += got;
+  stats.inflated += got;
+  return (sent > 0) ? got : 0;
+}
+
+// Take up to count frames back and free them. Returns how many
+static uint32_t deflate(uint32_t count){
+  if (count > BALLOON_ARRAY_PFNS){
+    count = BALLOON_ARRAY_PFNS;
+  }
+  if (count > stats.held){
+    count = stats.held;
+  }
+  if (!count){
+    return 0;
+  }
+
+  memcpy(pfns, &balloon_frames[stats.held - count], count * sizeof(uint32_t));
+
+  // MUST_TELL_HOST is never negotiated, so the frames are ours again
+  // even if the host doesn't hear about it; it's told regardless
+  virtqueue_transfer(&balloon_dev, &deflate_vq, (uint32_t)virt_to_phys(pfns), count * sizeof(uint32_t), 0);
+
+  stats.held -= count;
+  stats.deflated += count;
+  free_frames(pfns, count);
+  return count;
+}
+
+uint32_t balloon_deflate_on_oom(uint32_t count){
+  if (!balloon_present || !(features & BALLOON_F_DEFLATE_ON_OOM)){
+    return 0;
+  }
+
+  // balloon_update drops the lock between batches, so check busy under it
+  lock_scheduler();
+  if (balloon_busy){
+    unlock_scheduler();
+    return 0;
+  }
+  balloon_busy = 1;
+
+  uint32_t freed = deflate(count);
+  stats.oom_deflated += freed;
+  virtio_config_write32(&balloon_dev, BALLOON_CONFIG_ACTUAL, stats.held);
+
+  balloon_busy = 0;
+  unlock_scheduler();
+
+  return freed;
+}
+
+// ----------------------------------------
+// Statistics
+// ----------------------------------------
+
+static void fill_stats(){
+  uint64_t free_bytes = (uint64_t)count_free_frames() * PAGE_SIZE;
+
+  stat_buffer[0].tag = BALLOON_STAT_MEMFREE;
+  stat_buffer[0].val = free_bytes;
+  stat_buffer[1].tag = BALLOON_STAT_MEMTOT;
+  stat_buffer[1].val = (uint64_t)num_frames * PAGE_SIZE;
+  stat_buffer[2].tag = BALLOON_STAT_AVAIL;
+  stat_buffer[2].val = free_bytes;
+}
+
+// The host asks for statistics by returning the buffer; refill it and
+// hand it straight back
+static void send_stats(){
+  fill_stats();
+  virtqueue_add(&stats_vq, (uint32_t)virt_to_phys(stat_buffer), sizeof(stat_buffer), 0);
+  virtio_kick(&balloon_dev, &stats_vq);
+}
+
+void get_balloon_stats(balloon_stats_t* out){
+  lock_scheduler();
+  *out = stats;
+  unlock_scheduler();
+}
+
+// ----------------------------------------
+// Balloon Task
+// ----------------------------------------
+
+// One inflate/deflate batch under the lock. Returns how many frames moved
+static uint32_t balloon_step(){
+  uint32_t moved = 0;
+
+  lock_scheduler();
+  if (stats.held < stats.target){
+    moved = inflate(stats.target - stats.held);
+  } else if (stats.held > stats.target){
+    moved = deflate(stats.held - stats.target);
+  }
+  unlock_scheduler();
+
+  return moved;
+}
+
+static void balloon_update(){
+  lock_scheduler();
+  balloon_busy = 1;
+  stats.target = virtio_config_read32(&balloon_dev, BALLOON_CONFIG_NUM_PAGES);
+  unlock_scheduler();
+
+  // A big resize can be tens of thousands of frames. Interrupts come
+  // back on between batches of BALLOON_ARRAY_PFNS; balloon_busy keeps
+  // the OOM path out until the whole resize is done
+  while (balloon_step());
+
+  lock_scheduler();
+  virtio_config_write32(&balloon_dev, BALLOON_CONFIG_ACTUAL, stats.held);
+
+  if ((features & BALLOON_F_STATS_VQ) && virtqueue_get_used(&stats_vq) >= 0){
+    send_stats();
+  }
+
+  balloon_busy = 0;
+  unlock_scheduler();
+}
+
+static void balloon_task(){
+  while (1){
+    balloon_update();
+    ms_sleep(BALLOON_POLL_MS);
+  }
+}
+
+// ----------------------------------------
+// Setup
+// ----------------------------------------
+
+void setup_balloon(){
+  if (!virtio_probe(VIRTIO_BALLOON_DEVICE_ID, &balloon_dev)){
+    return;
+  }
+
+  features = virtio_negotiate(&balloon_dev, BALLOON_F_STATS_VQ | BALLOON_F_DEFLATE_ON_OOM);
+
+  if (!virtio_setup_queue(&balloon_dev, &inflate_vq, BALLOON_QUEUE_INFLATE) ||
+      !virtio_setup_queue(&balloon_dev, &deflate_vq, BALLOON_QUEUE_DEFLATE)){
+    printf("Balloon: queue setup failed\n");
+    return;
+  }
+  if ((features & BALLOON_F_STATS_VQ) && !virtio_setup_queue(&balloon_dev, &stats_vq, BALLOON_QUEUE_STATS)){
+    features &= ~BALLOON_F_STATS_VQ;
+  }
+
+  virtio_driver_ok(&balloon_dev);
+
+  // The device expects a stats buffer to be waiting from the start
+  if (features & BALLOON_F_STATS_VQ){
+    send_stats();
+  }
+
+  balloon_present = 1;
+  printf("Balloon: virtio-balloon up%s\n", (features & BALLOON_F_DEFLATE_ON_OOM) ? ", deflate on OOM" : "");
+
+  tcb_t* task = create_kernel_task(&balloon_task);
+  if (!task){
+    printf("Balloon: couldn't start the balloon task\n");
+    return;
+  }
+  set_task_priority(task, PRIORITY_BATCH);
+}
@@ -1,18 +1,31 @@
 #include <kernel/boot_heap.h>
+#include <kernel/pmm.h>
+#include <kernel/vmm.h>
 #include <common/inline_assembly.h>
+#include <common/init.h>
+#include <stdio.h>
 
 // ------------------
 // _kernel_end defined in linker
 extern uint32_t k_workspace_end;
 static uint32_t next_alloc = (uint32_t)0x0;
 
-void setup_boot_heap(){
+// Set once free_boot_memory() has run; the tail of
+// the boot mapping no longer belongs to us after that
+static uint8_t boot_heap_released = 0;
+
+void __init setup_boot_heap(){
   next_alloc = k_workspace_end;
 }
 
 
 uint32_t boot_alloc(uint32_t size, uint32_t align){
 
+  if (boot_heap_released){
+    printf("ERROR: boot_alloc called after boot memory was freed\n");
+    return 0x0;
+  }
+
   if (align && (next_alloc & 0x00000FFF)){
     next_alloc += 0x00000FFF;
     next_alloc &= 0xFFFFF000;
@@ -27,3 +40,35 @@ uint32_t boot_alloc_frame(){
   return boot_alloc(0x1000, 1);
 }
 
+// ----------------------------------
+// Reclaiming boot memory
+// ----------------------------------
+
+// Give every frame in [start, end) back to the PMM. The pages stay
+// mapped: they are part of the direct map, and get reused through it
+static uint32_t release_boot_range(uint32_t start, uint32_t end){
+  uint32_t num_freed = 0;
+
+  for (uint32_t addr = start; addr < end; addr += PAGE_SIZE){
+    free_phys_frame(virt_to_phys((void*)addr));
+    num_freed++;
+  }
+
+  return num_freed;
+}
+
+void free_boot_memory(){
+
+  // Boot-only code and data (.init.text / .init.data)
+  uint32_t init_start = (uint32_t)&_init_start;
+  uint32_t init_end = (uint32_t)&_init_end;
+  uint32_t num_freed = release_boot_range(init_start, init_end);
+
+  // Whatever the bump allocator never handed out, up to the end of
+  // the 4MB that boot.S mapped for us
+  boot_heap_released = 1;
+  uint32_t heap_tail = (next_alloc + 0x00000FFF) & 0xFFFFF000;
+  num_freed += release_boot_range(heap_tail, BOOT_MAPPING_END);
+
+  printf("Freed %d KiB of boot memory\n", num_freed * (PAGE_SIZE / 1024));
+}
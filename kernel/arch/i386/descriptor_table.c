@@ -1,12 +1,17 @@
 #include "kernel/descriptor_table.h"
 #include "kernel/tss.h"
 #include "string.h"
+#include "common/init.h"
+#include "common/inline_assembly.h"
 
-#define NUM_GDT_ENTRIES 6
+#define NUM_GDT_ENTRIES 7
 
 // Used for context switching
 tss_t context_tss;
 
+// Runs the double fault handler on a stack of its own
+tss_t double_fault_tss;
+
 
 // For accessing assembly function
 extern void gdt_flush(uint32_t);
@@ -15,18 +20,20 @@ extern void ldt_flush();
 static void init_gdt();
 static void gdt_set_gate(int32_t idx, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
 static void gdt_set_tss_gate(int32_t idx, tss_t* task_struct);
+static void gdt_set_fault_tss_gate(int32_t idx, tss_t* task_struct);
 
-// We want 6 entries for our GDT: null, kernel code, kernel data, user code, user data, TSS
+// We want 7 entries for our GDT: null, kernel code, kernel data, user code, user data,
+// TSS, double fault TSS
 gdt_entry_t gdt_entries[NUM_GDT_ENTRIES];
-gdt_ptr_t gdt_ptr;
+gdt_ptr_t gdt_ptr __initdata;  // Only read by lgdt
 
 
 // Implementation
-void init_descriptor_tables(){
+void __init init_descriptor_tables(){
   init_gdt();
 }
 
-static void init_gdt(){
+static void __init init_gdt(){
 
   // Set up the actual ptr
   // The offset is the linear address of the table itself, which means that paging applies.
@@ -45,11 +52,14 @@ static void init_gdt(){
   // TSS for context switching
   gdt_set_tss_gate(5, &context_tss);
 
+  // TSS for the double fault task
+  gdt_set_fault_tss_gate(6, &double_fault_tss);
+
   gdt_flush((uint32_t)&gdt_ptr);
   ldt_flush();
 }
 
-static void gdt_set_gate(int32_t idx, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+static void __init gdt_set_gate(int32_t idx, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
 
   // First 2 bytes of base, then third byte of base, then fourth
   gdt_entries[idx].base_low    = (base & 0xFFFF);
@@ -71,7 +81,7 @@ static void gdt_set_gate(int32_t idx, uint32_t base, uint32_t limit, uint8_t acc
 }
 
 
-static void gdt_set_tss_gate(int32_t idx, tss_t* task_struct) {
+static void __init gdt_set_tss_gate(int32_t idx, tss_t* task_struct) {
 
   // Kernel data segment offset
   uint16_t kernel_data_offset = 0x10;
@@ -106,6 +116,36 @@ static void gdt_set_tss_gate(int32_t idx, tss_t* task_struct) {
 
 }
 
+// A kernel task that starts at double_fault, on its own stack, with
+// IRQs off. Entered only through the IDT task gate, never by ltr
+static void __init gdt_set_fault_tss_gate(int32_t idx, tss_t* task_struct) {
+  extern void double_fault();
+  extern uint8_t double_fault_stack_top[];
+
+  memset(task_struct, 0x0, sizeof(tss_t));
+  task_struct->eip = (uint32_t)double_fault;
+  task_struct->esp = (uint32_t)double_fault_stack_top;
+  task_struct->eflags = 0x2;  // Reserved bit; IF clear
+  task_struct->cs = 0x08;
+  task_struct->ds = 0x10;
+  task_struct->ss = 0x10;
+  task_struct->es = 0x10;
+  task_struct->fs = 0x10;
+  task_struct->gs = 0x10;
+
+  // The boot directory for now; setup_task_stacks() points it at the
+  // kernel's once paging is up
+  task_struct->cr3 = READ_CR3();
+
+  // Pr = 0b1, Priv = 0b00, S = 0b0, Type = 0b1001 (available 32-bit TSS)
+  uint8_t access = 0x89;
+  uint8_t gran = 0x0;
+
+  uint32_t base = (uint32_t)task_struct;
+  uint32_t limit = sizeof(tss_t) - 1;
+  gdt_set_gate(idx, base, limit, access, gran);
+}
+
 void set_kernel_stack(uint32_t stack){
   context_tss.esp0 = stack;
 }
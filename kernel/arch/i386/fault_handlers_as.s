@@ -9,23 +9,30 @@ page_fault:
 	# push all registers before handling 
 	pusha
 
+	# Push where the return eip is saved, so a fault in a user access
+	# routine can be sent to its fixup (see uaccess.h)
+	# pusha pushes 8*4-byte registers, the err code is 32 bytes up
+	# and eip just past it
+	leal 36(%esp), %eax
+	pushl %eax
+
 	# Push condition code and faulting address
 	# page_fault is not a function call, so esp was the error code
-	# pusha pushes 8*4-byte registers, aso err code is 32 bytes up
-	pushl 32(%esp)
+	# (now 36 bytes up, past the pointer just pushed)
+	pushl 36(%esp)
 	movl %cr2, %eax
 	pushl %eax
 
 	cld # clear DF before function call
 	call page_fault_handler
 
-	# reload CR3 with updated page directory
-	movl %cr3, %ecx
-	movl %ecx, %cr3
+	# page_fault_handler invalidates whatever it changed,
+	# so no CR3 reload (full TLB flush) here
 	
 	# pop page_fault_handler args
 	popl %eax
 	popl %ecx
+	popl %ecx
 	
 
 page_present:
@@ -39,3 +46,30 @@ page_present:
 	iret
 
 	
+
+.global double_fault
+.global double_fault_handler
+.global double_fault_stack_top
+
+# Double faults come in through a task gate (IDT [8]), so this runs as
+# its own task on its own stack: the CPU switched to double_fault_tss
+# and saved the faulting task in context_tss. That keeps us alive when
+# the fault was pushing a frame onto an unbacked page of a task stack
+double_fault:
+
+	# pop error code (always 0)
+	addl $4, %esp
+
+	cld # clear DF before function call
+	call double_fault_handler
+
+	# NT is set, so iret switches back to the faulting task, which
+	# retries the access. The next double fault resumes below
+	iret
+	jmp double_fault
+
+.section .bss
+.align 16
+double_fault_stack:
+	.skip 4096
+double_fault_stack_top:
@@ -1,14 +1,99 @@
 #include "kernel/pmm.h"
 #include "kernel/vmm.h"
+#include "kernel/vma.h"
+#include "kernel/task_stack.h"
+#include "kernel/uaccess.h"
+#include "kernel/tss.h"
+#include "kernel/multitasking.h"
 #include "common/inline_assembly.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Page fault error code bits
+#define PF_PRESENT 0x1   // Set: protection violation. Clear: page not present
+#define PF_WRITE   0x2   // Set: faulting access was a write
+#define PF_USER    0x4   // Set: fault came from ring 3
+
+// A fault we can't (or mustn't) resolve, e.g. a null dereference.
+// In the kernel, one of the user access routines (uaccess.h) survives
+// it: eip points at the saved return address, which goes to the fixup
+static void bad_page_fault(uint32_t faulting_addr, uint32_t error_code, uint32_t* eip, char* reason){
+  if (!(error_code & PF_USER)){
+    uint32_t fixup = search_exception_table(*eip);
+    if (fixup){
+      *eip = fixup;
+      return;
+    }
+  }
+
+  printf("Page fault at %x (error %x): %s\n", faulting_addr, error_code, reason);
+  abort();
+}
 
 // Page Fault Handler
-void page_fault_handler(uint32_t faulting_addr, uint32_t error_code){
+void page_fault_handler(uint32_t faulting_addr, uint32_t error_code, uint32_t* eip){
+
+  // Only addresses inside a region are ever valid
+  vma_t* vma = lookup_vma(faulting_addr);
+  if (!vma){
+    bad_page_fault(faulting_addr, error_code, eip, "no region");
+    return;
+  }
+
+  // Ring 3 never touches a kernel region, present or not. Checked before
+  // anything is swapped in or allocated on its behalf
+  if ((error_code & PF_USER) && !(vma->prot & VMA_USER)){
+    bad_page_fault(faulting_addr, error_code, eip, "user access to kernel region");
+    return;
+  }
+
+  if ((error_code & PF_PRESENT) == 0){
+    if ((error_code & PF_WRITE) && !(vma->prot & VMA_WRITE)){
+      bad_page_fault(faulting_addr, error_code, eip, "write to read-only region");
+      return;
+    }
 
-  if ((error_code & 0x1) == 0){
-    page_t* newpage = get_page(faulting_addr, 1);
-    if (!newpage->present && !newpage->frame){
-      alloc_frame(newpage, 1, 1);
+    // Page was evicted to swap: bring it back
+    int swapped = handle_swap_fault(vma, faulting_addr);
+    if (swapped < 0){
+      bad_page_fault(faulting_addr, error_code, eip, "swap-in failed");
+      return;
     }
+    if (swapped){
+      return;
+    }
+
+    if (!(vma->flags & VMA_DEMAND)){
+      bad_page_fault(faulting_addr, error_code, eip, "region is not demand paged");
+      return;
+    }
+
+    if (!handle_demand_fault(vma, faulting_addr)){
+      bad_page_fault(faulting_addr, error_code, eip, "out of memory");
+    }
+  } else if (error_code & PF_WRITE){
+    // Write to a present, read-only page: copy-on-write
+    if (!(vma->prot & VMA_WRITE) || !handle_cow_fault(faulting_addr)){
+      bad_page_fault(faulting_addr, error_code, eip, "write to read-only page");
+    }
+  } else {
+    bad_page_fault(faulting_addr, error_code, eip, "protection violation");
   }
 }
+
+// Double Fault Handler
+// Runs as the double fault task (see double_fault in fault_handlers_as.s).
+// The one we recover from is a task stack growing into an unbacked page
+// in ring 0: the page fault frame itself had nowhere to go
+void double_fault_handler(){
+  uint32_t faulting_addr = READ_CR2();
+
+  if (!grow_task_stack(faulting_addr)){
+    printf("Double fault at eip %x, esp %x (last fault address %x)\n", context_tss.eip, context_tss.esp, faulting_addr);
+    abort();
+  }
+
+  // The switch back loads CR3 from context_tss, but the switch here
+  // never saved it there
+  context_tss.cr3 = curr_tcb ? curr_tcb->cr3 : kernel_mm.pgdir;
+}
@@ -1,16 +1,19 @@
 #include <stdint.h>
 #include "kernel/idt.h"
 #include "kernel/PIC.h"
+#include "common/init.h"
 
 // IDT constants
 #define KERNEL_CODE_SEGMENT 0x8 // Offset in GDT
 #define INTERRUPT_GATE 0x8E
+#define TASK_GATE 0x85
+#define DOUBLE_FAULT_TSS_SEGMENT 0x30 // Offset in GDT
 
 // DESCRIPTOR TABLE
 // 256 is the standard size
 struct IDT_entry IDT_entries[256];
 
-void idt_init(){
+void __init idt_init(){
 
   // IDT [32-47]
   setup_interrupt_service_routines();
@@ -18,6 +21,9 @@ void idt_init(){
   // IDT [14]
   setup_page_fault_handler();
 
+  // IDT [8]
+  setup_double_fault_handler();
+
   // Load the IDT Table -- Assembly function for lidt call
   extern int load_idt();
   struct IDT_ptr idt_ptr;
@@ -27,7 +33,7 @@ void idt_init(){
 
 }
 
-void setup_interrupt_service_routines() {
+void __init setup_interrupt_service_routines() {
 
  
   // Refer to assembly ISRs
@@ -189,7 +195,7 @@ void setup_interrupt_service_routines() {
 // ---------------------------------
 // Page Fault Handler
 // ---------------------------------
-void setup_page_fault_handler(){
+void __init setup_page_fault_handler(){
   extern int page_fault();
   uint32_t page_fault_addr = (uint32_t)page_fault;
   IDT_entries[14].offset_low = page_fault_addr & 0xFFFF; // Lower 2 bytes
@@ -198,3 +204,13 @@ void setup_page_fault_handler(){
   IDT_entries[14].zero = 0;
   IDT_entries[14].type_attr = INTERRUPT_GATE;
 }
+
+// A task gate: the CPU switches to double_fault_tss, so the handler
+// gets a good stack even when the faulting one has run out
+void __init setup_double_fault_handler(){
+  IDT_entries[8].offset_low = 0;
+  IDT_entries[8].offset_high = 0;
+  IDT_entries[8].selector = DOUBLE_FAULT_TSS_SEGMENT;
+  IDT_entries[8].zero = 0;
+  IDT_entries[8].type_attr = TASK_GATE;
+}
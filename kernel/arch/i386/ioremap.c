@@ -0,0 +1,99 @@
+#include <kernel/ioremap.h>
+#include <kernel/vmalloc.h>
+#include <kernel/vma.h>
+#include <kernel/vmm.h>
+#include <kernel/tlb.h>
+#include <kernel/multitasking.h>
+#include <common/inline_assembly.h>
+#include <common/init.h>
+#include <stdio.h>
+
+// Set once the PAT holds PAT_LAYOUT
+static uint8_t pat_enabled = 0;
+
+// ----------------------------------------
+// Setup
+// ----------------------------------------
+
+uint32_t __init setup_pat(){
+  uint32_t eax, ebx, ecx, edx;
+  CPUID(0x1, &eax, &ebx, &ecx, &edx);
+  if (!(edx & CPUID_FEAT_EDX_PAT)){
+    return 0;
+  }
+
+  // Nothing maps with PWT yet, but flush anything cached under the
+  // old types before they change
+  WBINVD();
+  WRMSR(MSR_PAT, PAT_LAYOUT);
+  WBINVD();
+  flush_tlb_global();
+
+  pat_enabled = 1;
+  return 1;
+}
+
+// ----------------------------------------
+// Device Memory Mappings
+// ----------------------------------------
+
+static void* ioremap_flags(phys_addr_t paddr, uint32_t size, uint32_t flags){
+  if (size == 0){
+    return 0;
+  }
+
+  // Whole pages around [paddr, paddr + size)
+  uint32_t offset = (uint32_t)(paddr & 0xFFF);
+  phys_addr_t base = paddr - offset;
+  uint32_t num_pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+  uint32_t span = num_pages * PAGE_SIZE;
+
+  lock_scheduler();
+
+  // Fixed: mapped here and never faulted in
+  uint32_t start = find_vma_gap(kernel_vmas, VMALLOC_START, VMALLOC_END, span + PAGE_SIZE);
+  vma_t* vma = 0;
+  if (start){
+    vma = insert_vma(&kernel_vmas, start, start + span, VMA_READ | VMA_WRITE, VMA_GUARD, VMA_FIXED);
+  }
+  if (vma && !map_range(start, base, num_pages, MAP_WRITE | flags)){
+    unmap_range(start, num_pages, 0);
+    remove_vma(&kernel_vmas, start);
+    vma = 0;
+  }
+
+  unlock_scheduler();
+
+  if (!vma){
+    printf("ioremap: can't map %d bytes\n", size);
+    return 0;
+  }
+  return (void*)(start + offset);
+}
+
+void* ioremap(phys_addr_t paddr, uint32_t size){
+  return ioremap_flags(paddr, size, MAP_UC);
+}
+
+void* ioremap_wc(phys_addr_t paddr, uint32_t size){
+  return ioremap_flags(paddr, size, pat_enabled ? MAP_WC : MAP_UC);
+}
+
+void iounmap(void* addr){
+  uint32_t start = (uint32_t)addr & 0xFFFFF000;
+
+  lock_scheduler();
+
+  vma_t* vma = find_vma(kernel_vmas, start);
+  if (!vma || vma->start != start || vma->backing != VMA_FIXED || start < VMALLOC_START || start >= VMALLOC_END){
+    unlock_scheduler();
+    printf("iounmap: %x is not an ioremap region\n", start);
+    return;
+  }
+
+  // Device memory: the frames aren't the PMM's to free
+  unmap_range(vma->start, (vma->end - vma->start) / PAGE_SIZE, 0);
+  remove_vma(&kernel_vmas, start);
+
+  unlock_scheduler();
+}
@@ -46,16 +46,16 @@ void irq0_handler(void) {
   // Now perform handler code / timer updates
   wake_sleeping_tasks();
 
-  // Handle end-of-time-slice
-  // For safety, make sure we didn't wrap around the unsigned int
-  if (time_slice_remaining == 0 || time_slice_remaining > TIME_SLICE_LENGTH_MS){
+  // Handle end-of-time-slice: this tick uses up what's left of it
+  uint64_t tick_ms = ms_per_tick();
+  if (time_slice_remaining <= tick_ms){
     //printf("Task switch - time = %d\n", time_slice_remaining);
 
     time_slice_remaining = TIME_SLICE_LENGTH_MS;
     //switch_to_next_task();
     schedule();
   } else {
-    time_slice_remaining -= ms_per_tick();
+    time_slice_remaining -= tick_ms;
   }
 
   // Send EOI, we got what we needed from the interrupt
@@ -2,8 +2,11 @@
 #include <kernel/pmm.h>
 #include <kernel/vmm.h>
 #include <kernel/boot_heap.h>
+#include <kernel/vma.h>
+#include <kernel/page_ops.h>
 #include <common/inline_assembly.h>
 #include <common/testing.h>
+#include <common/init.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -137,15 +140,19 @@ uint32_t GET_HEAP_SIZE(){
 // -----------------------
 
 
-void setup_kheap(){
+void __init setup_kheap(){
 
   // Need boot heap to place heap structures
   setup_boot_heap();
-  kheap = create_heap(0xD0000000, KHEAP_INITIAL_SIZE, 0x3);
+
+  // Claim the heap's virtual range; its pages are faulted in on demand
+  insert_vma(&kernel_vmas, KHEAP_START, KHEAP_START + KHEAP_MAX_SIZE, VMA_READ | VMA_WRITE, VMA_DEMAND, VMA_HEAP);
+
+  kheap = create_heap(KHEAP_START, KHEAP_INITIAL_SIZE, 0x3);
 
 }
 
-heap_t* create_heap(uint32_t start_addr, uint32_t size, uint8_t flags){
+heap_t* __init create_heap(uint32_t start_addr, uint32_t size, uint8_t flags){
 
   heap_t* new_heap = (heap_t*)boot_alloc(sizeof(heap_t), 0);
 
@@ -160,7 +167,7 @@ heap_t* create_heap(uint32_t start_addr, uint32_t size, uint8_t flags){
   new_heap->heap_start = start_addr;
   new_heap->prog_break = start_addr;
   new_heap->heap_end = start_addr + size;
-  new_heap->max_size = 0x10000000;
+  new_heap->max_size = KHEAP_MAX_SIZE;
   new_heap->flags = flags;
 
   // Pointer is always to the block of mem itself, not the header
@@ -377,7 +384,7 @@ void kfree(void* ptr, heap_t* heap){
 // ----------------------------------------------------------------------------
 
 
-static void print_block(header_t* hdr){
+static void __init print_block(header_t* hdr){
 
   // Get necessary data
   void* ptr = GET_DATA(hdr);
@@ -397,7 +404,7 @@ static void print_block(header_t* hdr){
 
 }
 
-static void print_freelist(heap_t* heap){
+static void __init print_freelist(heap_t* heap){
 
   printf("---- Printing Freelist ----\n");
   free_hdr_t* free_itr = heap->freelist_head;
@@ -407,7 +414,7 @@ static void print_freelist(heap_t* heap){
   }
 }
 
-static uint32_t count_free_blocks(heap_t* heap){
+static uint32_t __init count_free_blocks(heap_t* heap){
   uint32_t num_free_blocks = 0;
   
   free_hdr_t* free_itr = heap->freelist_head;
@@ -419,7 +426,7 @@ static uint32_t count_free_blocks(heap_t* heap){
   return num_free_blocks;
 }
 
-static void print_heap_change(char* op, uint32_t* ptr, free_hdr_t* freelist_head){
+static void __init print_heap_change(char* op, uint32_t* ptr, free_hdr_t* freelist_head){
   printf("%s, addr = %x -- freelist_head = %x\n", op, (uint32_t)ptr, (uint32_t)freelist_head);
 }
 
@@ -428,18 +435,18 @@ static void print_heap_change(char* op, uint32_t* ptr, free_hdr_t* freelist_head
 // **** DANGER: THIS WILL RESET THE ENTIRE HEAP ****
 // **** USE ONLY FOR TESTING AND DEBUGGING ****
 // **************************************************
-static void clear_heap(uint32_t safety) {
+static void __init clear_heap(uint32_t safety) {
 
   // Just make sure I don't accidentally call this
   if (safety != 8675309){
     return;
   }
   
-  // Zero out the entire heap section
-  void* heap = (void*)kheap->heap_start;
+  // Zero out the entire heap section (it spans whole pages)
   uint32_t size = kheap->heap_end - kheap->heap_start;
-  uint32_t val = 0x0;
-  memset(heap, val, size);
+  for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE){
+    clear_page((void*)(kheap->heap_start + offset));
+  }
 
   // Set up the heap for use
   uint32_t avail_space = DATA_SIZE(size);
@@ -450,7 +457,7 @@ static void clear_heap(uint32_t safety) {
 
 }
 
-void TEST_alloc(){
+void __init TEST_alloc(){
 
   // Make sure we have a fresh heap
   clear_heap(8675309);
@@ -481,7 +488,7 @@ void TEST_alloc(){
   clear_heap(8675309);
 }
 
-void TEST_free(){
+void __init TEST_free(){
   // Make sure we have a fresh heap
   clear_heap(8675309);
 
@@ -529,7 +536,7 @@ void TEST_free(){
   clear_heap(8675309);
 }
 
-void TEST_freelist(){
+void __init TEST_freelist(){
   // Make sure we have a fresh heap
   clear_heap(8675309);
 
@@ -681,7 +688,7 @@ void TEST_freelist(){
   clear_heap(8675309);
 }
 
-void TEST_coalesce(){
+void __init TEST_coalesce(){
   // Make sure we have a fresh heap
   clear_heap(8675309);
 
@@ -744,7 +751,7 @@ void TEST_coalesce(){
   clear_heap(8675309);
 }
 
-void TEST_multiple_page_heap(){
+void __init TEST_multiple_page_heap(){
   // Make sure we have a fresh heap
   clear_heap(8675309);
 
@@ -790,7 +797,7 @@ void TEST_multiple_page_heap(){
   clear_heap(8675309);
 }
 
-void TEST_kheap(){
+void __init TEST_kheap(){
 
   TEST_alloc();
   TEST_free();
@@ -0,0 +1,38 @@
+#include <kernel/ksm.h>
+#include <kernel/vmm.h>
+#include <kernel/sleep.h>
+#include <kernel/multitasking.h>
+#include <stdio.h>
+
+static uint32_t scan_pages = KSM_DEFAULT_PAGES;
+static uint32_t scan_interval_ms = KSM_DEFAULT_INTERVAL_MS;
+static uint32_t total_merged = 0;
+
+static void merge_task(){
+  while (1){
+    if (scan_pages){
+      total_merged += merge_pages(scan_pages);
+    }
+    ms_sleep(scan_interval_ms);
+  }
+}
+
+void create_merge_task(){
+  tcb_t* task = create_kernel_task(&merge_task);
+  if (!task){
+    printf("KSM: couldn't start the merge task\n");
+    return;
+  }
+
+  // Scanning is never urgent
+  set_task_priority(task, PRIORITY_BATCH);
+}
+
+void set_merge_rate(uint32_t num_pages, uint32_t interval_ms){
+  scan_pages = num_pages;
+  scan_interval_ms = interval_ms ? interval_ms : 1;
+}
+
+uint32_t pages_merged(){
+  return total_merged;
+}
@@ -0,0 +1,311 @@
+#include <kernel/lz.h>
+#include <kernel/kheap.h>
+#include <kernel/paging.h>
+#include <common/testing.h>
+#include <common/init.h>
+#include <string.h>
+
+// Most recent input position for each hash. Never cleared: a stale
+// entry (from an earlier block) is caught by the byte comparison, so
+// the only cost is a missed match. Callers serialise through the
+// scheduler lock
+static uint16_t match_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t read32(const uint8_t* p){
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t lz_hash(uint32_t seq){
+  return (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Bytes needed to encode a length past its 15 in the token
+static inline uint32_t length_bytes(uint32_t len){
+  return (len >= 15) ? ((len - 15) / 255) + 1 : 0;
+}
+
+static uint8_t* write_length(uint8_t* op, uint32_t len){
+  if (len < 15){
+    return op;
+  }
+
+  len -= 15;
+  while (len >= 255){
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+// Append one sequence: literals [lit, lit + lit_len), then (unless
+// match_len is 0) a match of match_len bytes, offset back. 0 if full
+static uint8_t* write_sequence(uint8_t* op, uint8_t* end, const uint8_t* lit, uint32_t lit_len,
+			       uint32_t offset, uint32_t match_len){
+
+  uint32_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+  uint32_t needed = 1 + length_bytes(lit_len) + lit_len;
+  if (match_len){
+    needed += 2 + length_bytes(match_code);
+  }
+  if ((uint32_t)(end - op) < needed){
+    return 0;
+  }
+
+  uint8_t* token = op++;
+  *token = (uint8_t)(((lit_len < 15) ? lit_len : 15) << 4);
+  op = write_length(op, lit_len);
+  memcpy(op, lit, lit_len);
+  op += lit_len;
+
+  if (match_len){
+    *token |= (uint8_t)((match_code < 15) ? match_code : 15);
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    op = write_length(op, match_code);
+  }
+  return op;
+}
+
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t max){
+  uint8_t* op = dst;
+  uint8_t* end = dst + max;
+  uint32_t ip = 0;
+  uint32_t anchor = 0;   // Start of the pending literals
+
+  // Positions must fit the table
+  if (len > 0xFFFF){
+    return 0;
+  }
+
+  while (ip + LZ_MIN_MATCH <= len){
+    uint32_t seq = read32(src + ip);
+    uint32_t h = lz_hash(seq);
+    uint32_t ref = match_table[h];
+    match_table[h] = (uint16_t)ip;
+
+    if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(src + ref) != seq){
+      ip++;
+      continue;
+    }
+
+    uint32_t match_len = LZ_MIN_MATCH;
+    while (ip + match_len < len && src[ref + match_len] == src[ip + match_len]){
+      match_len++;
+    }
+
+    op = write_sequence(op, end, src + anchor, ip - anchor, ip - ref, match_len);
+    if (!op){
+      return 0;
+    }
+    ip += match_len;
+    anchor = ip;
+  }
+
+  // Whatever is left goes out as literals
+  op = write_sequence(op, end, src + anchor, len - anchor, 0, 0);
+  if (!op){
+    return 0;
+  }
+  return op - dst;
+}
+
+// Read a length continued past 15; -1 if the input runs out
+static int32_t read_length(const uint8_t* src, uint32_t len, uint32_t* ip, uint32_t base){
+  if (base < 15){
+    return base;
+  }
+
+  uint8_t b;
+  do {
+    if (*ip >= len){
+      return -1;
+    }
+    b = src[(*ip)++];
+    base += b;
+  } while (b == 255);
+  return base;
+}
+
+int32_t lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t max){
+  uint32_t ip = 0;
+  uint32_t op = 0;
+
+  while (ip < len){
+    uint8_t token = src[ip++];
+
+    int32_t lit_len = read_length(src, len, &ip, token >> 4);
+    if (lit_len < 0 || (uint32_t)lit_len > len - ip || (uint32_t)lit_len > max - op){
+      return -1;
+    }
+    memcpy(dst + op, src + ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+
+    // Last sequence: literals only
+    if (ip == len){
+      break;
+    }
+
+    if (len - ip < 2){
+      return -1;
+    }
+    uint32_t offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+
+    int32_t match_len = read_length(src, len, &ip, token & 0xF);
+    if (match_len < 0){
+      return -1;
+    }
+    match_len += LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || (uint32_t)match_len > max - op){
+      return -1;
+    }
+
+    // Byte by byte: the match may overlap the bytes it produces
+    const uint8_t* match = dst + op - offset;
+    for (int32_t i = 0; i < match_len; i++){
+      dst[op + i] = match[i];
+    }
+    op += match_len;
+
+    // The stream always ends on a literals-only sequence (maybe empty),
+    // so running out right after a match means it was cut short
+    if (ip == len){
+      return -1;
+    }
+  }
+
+  return op;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+// TESTING
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+
+// Worst case for one page: all literals, plus the length bytes
+#define LZ_TEST_PACKED_MAX (PAGE_SIZE + (PAGE_SIZE / 255) + 16)
+
+static uint8_t* test_page;
+static uint8_t* test_packed;
+static uint8_t* test_out;
+static uint32_t test_seed = 0x2545F491;
+
+static uint32_t __init test_random(){
+  // xorshift32
+  test_seed ^= test_seed << 13;
+  test_seed ^= test_seed >> 17;
+  test_seed ^= test_seed << 5;
+  return test_seed;
+}
+
+// test_page must survive compression and expansion unchanged
+static void __init check_round_trip(){
+  uint32_t packed_len = lz_compress(test_page, PAGE_SIZE, test_packed, LZ_TEST_PACKED_MAX);
+  int packed = (packed_len != 0);
+  ASSERT_EQ(packed, 1);
+
+  memset(test_out, 0xAA, PAGE_SIZE);
+  int32_t out_len = lz_decompress(test_packed, packed_len, test_out, PAGE_SIZE);
+  ASSERT_EQ(out_len, PAGE_SIZE);
+
+  int same = (memcmp(test_page, test_out, PAGE_SIZE) == 0);
+  ASSERT_EQ(same, 1);
+}
+
+void __init TEST_lz_zero_page(){
+  memset(test_page, 0, PAGE_SIZE);
+  check_round_trip();
+
+  // One long match: should shrink to almost nothing
+  uint32_t packed_len = lz_compress(test_page, PAGE_SIZE, test_packed, LZ_TEST_PACKED_MAX);
+  int tiny = (packed_len < 64);
+  ASSERT_EQ(tiny, 1);
+
+  END_TEST(TEST_lz_zero_page);
+}
+
+void __init TEST_lz_random_page(){
+  // Random bytes from a small alphabet: short, scattered matches
+  for (uint32_t i = 0; i < PAGE_SIZE; i++){
+    test_page[i] = (uint8_t)(test_random() & 0x3);
+  }
+  check_round_trip();
+
+  END_TEST(TEST_lz_random_page);
+}
+
+void __init TEST_lz_pattern(){
+  // A 7-byte pattern: every match overlaps the bytes it produces
+  for (uint32_t i = 0; i < PAGE_SIZE; i++){
+    test_page[i] = (uint8_t)("pattern"[i % 7]);
+  }
+  check_round_trip();
+
+  END_TEST(TEST_lz_pattern);
+}
+
+void __init TEST_lz_incompressible(){
+  for (uint32_t i = 0; i < PAGE_SIZE; i += 4){
+    uint32_t r = test_random();
+    memcpy(&test_page[i], &r, sizeof(r));
+  }
+
+  // No room to spare: must report that it didn't fit
+  uint32_t packed_len = lz_compress(test_page, PAGE_SIZE, test_packed, PAGE_SIZE);
+  ASSERT_EQ(packed_len, 0);
+
+  // Given the worst-case room, it still comes back intact
+  check_round_trip();
+
+  END_TEST(TEST_lz_incompressible);
+}
+
+void __init TEST_lz_truncated(){
+  for (uint32_t i = 0; i < PAGE_SIZE; i++){
+    test_page[i] = (uint8_t)("pattern"[i % 7] + (i / 512));
+  }
+  uint32_t packed_len = lz_compress(test_page, PAGE_SIZE, test_packed, LZ_TEST_PACKED_MAX);
+  int packed = (packed_len > 1);
+  ASSERT_EQ(packed, 1);
+
+  // Missing the last byte: rejected outright
+  int32_t out_len = lz_decompress(test_packed, packed_len - 1, test_out, PAGE_SIZE);
+  ASSERT_EQ(out_len, -1);
+
+  // Cut anywhere: never passes for the whole page
+  for (uint32_t cut = 0; cut < packed_len; cut++){
+    out_len = lz_decompress(test_packed, cut, test_out, PAGE_SIZE);
+    int short_or_bad = (out_len != PAGE_SIZE);
+    ASSERT_EQ(short_or_bad, 1);
+  }
+
+  // Nor may a good stream overrun a short destination
+  out_len = lz_decompress(test_packed, packed_len, test_out, PAGE_SIZE - 1);
+  ASSERT_EQ(out_len, -1);
+
+  END_TEST(TEST_lz_truncated);
+}
+
+void __init TEST_lz(){
+  test_page = (uint8_t*)kalloc(PAGE_SIZE, 0, kheap);
+  test_packed = (uint8_t*)kalloc(LZ_TEST_PACKED_MAX, 0, kheap);
+  test_out = (uint8_t*)kalloc(PAGE_SIZE, 0, kheap);
+  if (!test_page || !test_packed || !test_out){
+    printf("TEST_lz: out of memory\n");
+  } else {
+    TEST_lz_zero_page();
+    TEST_lz_random_page();
+    TEST_lz_pattern();
+    TEST_lz_incompressible();
+    TEST_lz_truncated();
+  }
+
+  kfree(test_page, kheap);
+  kfree(test_packed, kheap);
+  kfree(test_out, kheap);
+}
@@ -6,6 +6,8 @@
 #include <kernel/paging.h>
 #include <common/inline_assembly.h>
 #include <kernel/vmm.h>
+#include <kernel/task_stack.h>
+#include <kernel/sched_fair.h>
 #include <kernel/timer.h>
 
 // ----------------------------------------
@@ -20,8 +22,13 @@ uint8_t task_switches_postponed_flag = 0;
 // Manage Running & Ready Tasks
 // ------------------------------
 tcb_t* curr_tcb = 0;
-tcb_t* task_list_head = 0;
-tcb_t* task_list_tail = 0;
+
+// One FIFO of ready tasks per priority, and a bit for each non-empty
+// one, so picking the next task is a single bit scan. PRIORITY_NORMAL
+// has no FIFO: its tasks are in the fair class's tree (sched_fair.h)
+static tcb_t* ready_heads[NUM_PRIORITIES];
+static tcb_t* ready_tails[NUM_PRIORITIES];
+static uint32_t ready_bitmap = 0;
 // ------------------------------
 
 // ------------------------------
@@ -32,10 +39,30 @@ tcb_t* terminated_tasks = 0;
 tcb_t* cleanup_task = 0;
 // ------------------------------
 
+// ------------------------------
+// Retired Tasks
+// ------------------------------
+// TCB + stack pairs the cleanup task kept for reuse, chained through
+// next_task. Pooled stacks keep at most their top page
+static tcb_t* task_pool = 0;
+static uint32_t task_pool_size = 0;
+// ------------------------------
+
+// ------------------------------
+// Idle Task
+// ------------------------------
+// Runs when no other task is ready. Never on a ready queue
+static tcb_t* idle_task = 0;
+static uint64_t idle_time_ms = 0;
+// ------------------------------
+
 // ------------------------------
 // Misc. Data
 // ------------------------------
 static uint32_t task_id_counter = 0;
+
+// Borrowed address space to give back once the switch is done
+static mm_t* mm_to_drop = 0;
 // ------------------------------
 
 // ------------------------------
@@ -45,6 +72,9 @@ void append_ready_task(tcb_t* ready_task);
 void setup_new_task(void (*entry_EIP)());
 void cleanup_term_tasks();
 void cleanup_terminated_task(tcb_t* task);
+static void remove_ready_task(tcb_t* task);
+static void idle_loop();
+static void reset_time_slice(tcb_t* task);
 // ------------------------------
 
 void lock_scheduler(){
@@ -127,26 +157,88 @@ void initialize_multitasking(){
   curr_tcb->esp = esp;
   curr_tcb->esp0 = context_tss.esp0;
   curr_tcb->cr3 = cr3;
+  curr_tcb->mm = &kernel_mm;
+  curr_tcb->active_mm = &kernel_mm;
+  curr_tcb->kernel_thread = 0;
+  curr_tcb->priority = PRIORITY_NORMAL;
+  fair_init_task(curr_tcb);
   curr_tcb->state = TASK_RUNNING;
   curr_tcb->task_id = task_id_counter++;
   curr_tcb->next_task = 0;
   curr_tcb->prev_task = 0;
 
   // First tcb is running, no need to add to ready queue
+
+  // The scheduler falls back on this one when nothing else is ready,
+  // so it stays off the queues
+  idle_task = create_kernel_task(&idle_loop);
+  if (!idle_task){
+    printf("Err creating the idle task\n");
+    return;
+  }
+  remove_ready_task(idle_task);
+  idle_task->priority = PRIORITY_IDLE;
+}
+
+// A retired task whose stack has its top page backed again, or 0 if
+// the pool is empty
+static tcb_t* take_pooled_task(){
+  lock_scheduler();
+  tcb_t* task = task_pool;
+  if (task){
+    task_pool = task->next_task;
+    task_pool_size--;
+  }
+  unlock_scheduler();
+
+  if (!task){
+    return 0;
+  }
+
+  // Only the cleanup task puts anything here
+  uint32_t top = task->esp0;
+  if (task->state != TASK_TERMINATED || top <= TASK_STACK_START || top > TASK_STACK_END || (top & (PAGE_SIZE - 1))){
+    printf("Task pool: bad entry %x (stack %x)\n", (uint32_t)task, top);
+    return 0;
+  }
+
+  // trim_task_pool may have taken the top page; fills it only if so
+  if (!map_range(top - PAGE_SIZE, 0, 1, MAP_WRITE | MAP_ALLOC)){
+    free_task_stack(top);
+    kfree(task, kheap);
+    return 0;
+  }
+
+  return task;
 }
 
 extern void setup_new_task_asm();
-tcb_t* create_kernel_task(void (*entry_EIP)()){
-  tcb_t* new_tcb = (tcb_t*)kalloc(sizeof(tcb_t), 0, kheap);
-  if (!new_tcb){
-    printf("Err allocating initial tcb\n");
+static tcb_t* create_task(void (*entry_EIP)(), mm_t* new_vaddr_space, uint8_t kernel_thread){
+  if (!new_vaddr_space && !kernel_thread){
+    printf("Err allocating page directory for new task\n");
     return 0;
   }
 
-  // Grab some memory for the task's stack
-  uint32_t stack_size = 1024;
-  void* proc_stack = kalloc(stack_size, 0, kheap);
-  uint32_t stack_bottom = (uint32_t)proc_stack + stack_size; // start at the end
+  // Reuse a retired task if there is one, else go to the heap
+  tcb_t* new_tcb = take_pooled_task();
+  uint32_t stack_bottom = new_tcb ? new_tcb->esp0 : 0; // start at the end
+  if (!new_tcb){
+    new_tcb = (tcb_t*)kalloc(sizeof(tcb_t), 0, kheap);
+    if (!new_tcb){
+      printf("Err allocating initial tcb\n");
+      put_address_space(new_vaddr_space);
+      return 0;
+    }
+
+    // Reserve the task's stack; only its top page is backed for now
+    stack_bottom = alloc_task_stack();
+    if (!stack_bottom){
+      printf("Err allocating task stack\n");
+      kfree(new_tcb, kheap);
+      put_address_space(new_vaddr_space);
+      return 0;
+    }
+  }
 
   // Space for registers we pop off the stack
   // Pop order: ebp, edi, esi, ebx, eip
@@ -164,12 +256,15 @@ tcb_t* create_kernel_task(void (*entry_EIP)()){
   (*((uint32_t*)stack_bottom - 2)) = (uint32_t)(&setup_new_task_asm);
   (*((uint32_t*)stack_bottom - 1)) = (uint32_t)entry_EIP;
 
-  // @TODO initialize this w/ function for new Page Directory
-  page_directory_t* new_vaddr_space = (page_directory_t*)get_physaddr((uint32_t)get_page_directory());
-  
   new_tcb->esp = stack_bottom - initial_stack_size;
   new_tcb->esp0 = stack_bottom;
-  new_tcb->cr3 = (uint32_t)new_vaddr_space;
+  // Kernel threads pick up a directory each time they're switched to
+  new_tcb->cr3 = new_vaddr_space ? new_vaddr_space->pgdir : 0;
+  new_tcb->mm = new_vaddr_space;
+  new_tcb->active_mm = new_vaddr_space;
+  new_tcb->kernel_thread = kernel_thread;
+  new_tcb->priority = PRIORITY_NORMAL;
+  fair_init_task(new_tcb);
   new_tcb->state = TASK_READY;
   new_tcb->task_id = task_id_counter++;
 
@@ -179,9 +274,31 @@ tcb_t* create_kernel_task(void (*entry_EIP)()){
   return new_tcb;
 }
 
+tcb_t* create_kernel_task(void (*entry_EIP)()){
+  // No address space of its own; it runs on whichever one is loaded
+  return create_task(entry_EIP, 0, 1);
+}
+
+tcb_t* create_cloned_task(void (*entry_EIP)()){
+  // User half is a copy-on-write duplicate of the caller's
+  return create_task(entry_EIP, clone_address_space(), 0);
+}
+
+// Drop the address space a kernel thread borrowed, now that we're
+// running on another stack. Runs on both ends of a switch: after
+// switch_to_task_asm returns, and at the start of a new task
+static void finish_task_switch(){
+  mm_t* mm = mm_to_drop;
+  if (mm){
+    mm_to_drop = 0;
+    put_address_space(mm);
+  }
+}
+
 // This is the entry point into a new task; it performs any...
 // ...setup and other housekeeping before launching client code
 void setup_new_task(void (*entry_EIP)()){
+  finish_task_switch();
   unlock_scheduler();
   dump_lock_info();
   entry_EIP();
@@ -198,37 +315,136 @@ uint32_t get_task_id(){
 void append_ready_task(tcb_t* ready_task){
   // printf("Appending task %d\n", ready_task->task_id);
 
+  // Charge the running task before it's keyed into the tree, while it
+  // is still TASK_RUNNING so min_vruntime takes it into account
+  if (ready_task == curr_tcb && ready_task->priority == PRIORITY_NORMAL){
+    fair_update_curr(ready_task);
+  }
+
   // Regardless of source, if we want to append ready, make it ready
   ready_task->state = TASK_READY;
-  
-  if (!task_list_head){
-    task_list_head = ready_task;
-    task_list_tail = ready_task;
-    ready_task->next_task = 0;
+
+  // The idle task is what runs when the queues are empty
+  if (ready_task == idle_task){
+    return;
+  }
+
+  uint8_t priority = ready_task->priority;
+  ready_task->next_task = 0;
+
+  if (priority == PRIORITY_NORMAL){
     ready_task->prev_task = 0;
+    fair_enqueue(ready_task);
+    ready_bitmap |= (1 << priority);
+    return;
+  }
+
+  if (!ready_heads[priority]){
+    ready_heads[priority] = ready_task;
+    ready_tails[priority] = ready_task;
+    ready_task->prev_task = 0;
+    ready_bitmap |= (1 << priority);
     return;
   }
 
   // Set up pointers to add to linked list
-  ready_task->next_task = 0;
-  ready_task->prev_task = task_list_tail;
-  task_list_tail->next_task = ready_task;
+  ready_task->prev_task = ready_tails[priority];
+  ready_tails[priority]->next_task = ready_task;
+
+  // ready_task is now at the end of its queue
+  ready_tails[priority] = ready_task;
+}
+
+// Take a task off its ready queue, wherever it is in it
+static void remove_ready_task(tcb_t* task){
+  uint8_t priority = task->priority;
+
+  if (priority == PRIORITY_NORMAL){
+    fair_dequeue(task);
+    if (!fair_first()){
+      ready_bitmap &= ~(1 << priority);
+    }
+    return;
+  }
 
-  // ready_task is now at the end of the list
-  task_list_tail = ready_task;
+  if (task->prev_task){
+    task->prev_task->next_task = task->next_task;
+  } else {
+    ready_heads[priority] = task->next_task;
+  }
+  if (task->next_task){
+    task->next_task->prev_task = task->prev_task;
+  } else {
+    ready_tails[priority] = task->prev_task;
+  }
+
+  if (!ready_heads[priority]){
+    ready_bitmap &= ~(1 << priority);
+  }
+
+  task->next_task = 0; // Remove ready queue links
+  task->prev_task = 0; // Remove ready queue links
 }
 
+// Pop the first task of the most urgent non-empty queue, or hand back
+// the idle task if all are empty. Lowest set bit = lowest number =
+// most urgent (bsf)
 tcb_t* get_next_task(){
-  tcb_t* next_task = task_list_head;
+  if (!ready_bitmap){
+    return idle_task;
+  }
+
+  uint32_t priority = __builtin_ctz(ready_bitmap);
+  tcb_t* next_task = (priority == PRIORITY_NORMAL) ? fair_first() : ready_heads[priority];
+  remove_ready_task(next_task);
   return next_task;
 }
 
+void set_task_priority(tcb_t* task, uint8_t priority){
+  if (priority >= NUM_PRIORITIES){
+    printf("Priority must be 0 to %d\n", NUM_PRIORITIES - 1);
+    return;
+  }
+
+  // Stays below every queue
+  if (task == idle_task){
+    return;
+  }
+
+  lock_scheduler();
+
+  // Move it to the queue for its new level
+  if (task->state == TASK_READY){
+    remove_ready_task(task);
+    task->priority = priority;
+    append_ready_task(task);
+  } else {
+    task->priority = priority;
+  }
+
+  // Now outranks the running task, or the running task dropped below
+  // something ready: switch now, as unblock_task would, not next tick
+  uint8_t urgent = 0;
+  if (task->state == TASK_READY && curr_tcb && task->priority < curr_tcb->priority){
+    urgent = 1;
+  } else if (task == curr_tcb && ready_bitmap && (uint32_t)__builtin_ctz(ready_bitmap) < priority){
+    urgent = 1;
+  }
+
+  // (schedule() only flags the switch while switches are postponed)
+  if (urgent){
+    schedule();
+  }
+
+  unlock_scheduler();
+}
+
 // Current task is in running state
 // Already not on the ready queue, no need to explicitly remove
 void block_curr_task(char* msg){
   lock_scheduler();
   if (!msg) msg = "";
-  printf("blocking task %d: %s\n", curr_tcb->task_id, msg);
+  //printf("blocking task %d: %s\n", curr_tcb->task_id, msg);
   curr_tcb->state = TASK_BLOCKED;
   switch_to_next_task();
   unlock_scheduler();
@@ -237,23 +453,35 @@ void block_curr_task(char* msg){
 void unblock_task(tcb_t* task, uint8_t preempt){  
   lock_scheduler();
 
-  printf("unblocking task %d: %s\n", task->task_id, preempt ? "preempt" : "no preempt");
+  //printf("unblocking task %d: %s\n", task->task_id, preempt ? "preempt" : "no preempt");
+
+  // The woken task is more urgent than the one running. Anything is
+  // more urgent than the idle task
+  uint8_t urgent = curr_tcb && (curr_tcb == idle_task || task->priority < curr_tcb->priority);
 
-  // If we're not postponing, and if either:
-  // task_list is not null or we explicitly ask to preempt
-  if ((postpone_task_switches_counter == 0) && (!task_list_head || preempt)){
-    // Only one task was running
+  // If we're not postponing, and either we explicitly ask to preempt
+  // or the woken task is more urgent
+  if ((postpone_task_switches_counter == 0) && (preempt || urgent)){
     
     // Add current task to ready list
     append_ready_task(curr_tcb);
     curr_tcb->state = TASK_READY;
 
     // Pre-empty with newly unblocked task
+    // It skips the run tree, so place it as enqueueing would have
+    if (task->priority == PRIORITY_NORMAL){
+      fair_place_task(task);
+    }
     task->state = TASK_RUNNING;
     switch_to_task(task);
   } else {
-    // At least one task on ready queue, don't pre-empt
     append_ready_task(task);
+
+    // Switches are postponed (e.g. woken from an IRQ): have unlock_stuff
+    // reschedule rather than leave the urgent task for the next slice
+    if (urgent){
+      task_switches_postponed_flag = 1;
+    }
   }
   unlock_scheduler();
 }
@@ -291,67 +519,70 @@ void switch_to_next_task(){
     task_switches_postponed_flag = 1;
     return; 
   }
-  
-  tcb_t* next_task = get_next_task();
-
-  // If there is another task, switch to it
-  if (next_task){
-    // Update ready list head
-    task_list_head = next_task->next_task;
-    
-    // Switch to new task
-    next_task->state = TASK_RUNNING;
-    next_task->next_task = 0; // Remove ready queue links
-    next_task->prev_task = 0; // Remove ready queue links
-    switch_to_task(next_task);
-  } else if (curr_tcb->state == TASK_RUNNING) {
-    // Keep running if no other tasks
-    printf("No more tasks\n");
-  } else {
-    printf("No more tasks\n");
-    // Current running task blocked, no other tasks --> idle
-    tcb_t* task = curr_tcb;
-    curr_tcb = 0; // NULL
-    //uint64_t idle_start_time = ms_since_boot(); // For power management
-
-    // Do nothing while waiting for a task to unblock & become ready
-    // This won't happen until we get an IRQ (e.g. sleeping task wakes)
-    // IRQs are disabled, but we have to enable them to break this loop
-    // Leave postponed_flag set b/c we want to stay here until we're done
-
-    breakpoint("NO MORE TASKS");
-    do {
-      STI();
-      HLT();
-      CLI();
-    } while (task_list_head == 0);
-
-    // Give the task back
-    curr_tcb = task;
 
-    // Switch to the newly-unblocked task
-    // Unless that task was the one we borrowed here...
-    // .. in that case we're already on it; just return
-    
-    task = task_list_head;
-    task_list_head = task->next_task;
-    if (task != curr_tcb){
-      task->state = TASK_RUNNING;
-      switch_to_task(task);
-    }
+  // With nothing ready this is the idle task, so there's always one
+  // (0 only before initialize_multitasking has made the idle task)
+  tcb_t* next_task = get_next_task();
+  if (!next_task){
+    return;
   }
 
+  // Picked again (the only ready task, or idle with nothing else to
+  // do): keep running, on a fresh slice
+  if (next_task == curr_tcb){
+    curr_tcb->state = TASK_RUNNING;
+    reset_time_slice(curr_tcb);
+    return;
+  }
 
+  // Switch to new task
+  next_task->state = TASK_RUNNING;
+  switch_to_task(next_task);
 }
 
 extern void switch_to_task_asm(tcb_t* new_task); // Assembly function
+extern uint64_t time_slice_remaining;             // Counted down by the timer IRQ
+
+// Fair tasks get their share of the latency period
+static void reset_time_slice(tcb_t* task){
+  time_slice_remaining = (task->priority == PRIORITY_NORMAL) ? fair_time_slice(task) : TIME_SLICE_LENGTH_MS;
+}
+
 void switch_to_task(tcb_t* new_task){
   if (postpone_task_switches_counter != 0) {
     task_switches_postponed_flag = 1;
     return;
   }
 
+  // Lazy TLB: a kernel thread keeps the previous task's directory
+  // loaded (switch_to_task_asm skips equal cr3 values), so switching to
+  // it and back leaves the user TLB entries in place
+  tcb_t* prev_task = curr_tcb;
+
+  // Charge the outgoing task (a ready one was charged when it was
+  // queued), then start the incoming one's clock and slice
+  if (prev_task == idle_task){
+    idle_time_ms += ms_since_boot() - prev_task->exec_start;
+  }
+  if (prev_task->state != TASK_READY){
+    fair_update_curr(prev_task);
+  }
+  new_task->exec_start = ms_since_boot();
+  reset_time_slice(new_task);
+
+  if (new_task->kernel_thread){
+    new_task->active_mm = prev_task->active_mm;
+    get_address_space(new_task->active_mm);
+    new_task->cr3 = new_task->active_mm->pgdir;
+  }
+  if (prev_task->kernel_thread){
+    mm_to_drop = prev_task->active_mm;
+    prev_task->active_mm = 0;
+  }
+
   switch_to_task_asm(new_task);
+
+  finish_task_switch();
 }
 
 void terminate_task(){
@@ -379,6 +610,43 @@ void terminate_task(){
   unlock_stuff();
 }
 
+// Runs whenever nothing else is ready. Spare time goes to background
+// work (topping up the stack reserve, pre-zeroing frames), then the CPU
+// halts until the next IRQ.
+// Anything that becomes ready is switched to straight away, whether or
+// not the wake path managed to switch for us
+static void idle_loop(){
+  while (1){
+    if (ready_bitmap){
+      schedule_under_lock();
+      continue;
+    }
+    refill_stack_reserve();
+    if (zero_idle_frame()){
+      continue;
+    }
+
+    // Check and halt with interrupts off, so a wake-up can't land
+    // between the check and the hlt and sleep through until the next IRQ
+    CLI();
+    if (ready_bitmap){
+      STI();
+    } else {
+      STI_HLT();
+    }
+  }
+}
+
+uint64_t get_idle_time_ms(){
+  lock_scheduler();
+  uint64_t total = idle_time_ms;
+  if (curr_tcb == idle_task){
+    total += ms_since_boot() - idle_task->exec_start;
+  }
+  unlock_scheduler();
+  return total;
+}
+
 void create_cleanup_task(){
   cleanup_task = create_kernel_task(&cleanup_term_tasks);
 }
@@ -410,9 +678,41 @@ void cleanup_term_tasks(){
 }
 
 void cleanup_terminated_task(tcb_t* task){
+  // Release the task's private user half and page directory. A kernel
+  // thread (this one, say) may still have it loaded; if so, it goes
+  // when that thread switches away
+  put_address_space(task->mm);
+
+  // Keep the TCB and stack for the next task, if there's room. The
+  // stack goes back down to its top page
+  lock_scheduler();
+  if (task_pool_size < TASK_POOL_MAX){
+    unmap_range(task->esp0 - TASK_STACK_SIZE, (TASK_STACK_SIZE / PAGE_SIZE) - 1, MAP_ALLOC);
+    task->next_task = task_pool;
+    task_pool = task;
+    task_pool_size++;
+    unlock_scheduler();
+    return;
+  }
+  unlock_scheduler();
+
   // Cleanup the task stack
-  kfree((void*)task->esp0, kheap);
+  free_task_stack(task->esp0);
 
   // Cleanup the task structure
   kfree(task, kheap);
 }
+
+uint32_t trim_task_pool(uint32_t target){
+  uint32_t freed = 0;
+
+  // Only page tables are touched, so this is safe from inside the PMM
+  // (kheap may be mid-allocation); the TCBs and regions stay pooled
+  lock_scheduler();
+  for (tcb_t* task = task_pool; task && freed < target; task = task->next_task){
+    freed += unmap_range(task->esp0 - PAGE_SIZE, 1, MAP_ALLOC);
+  }
+  unlock_scheduler();
+
+  return freed;
+}
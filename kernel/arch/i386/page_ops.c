@@ -0,0 +1,104 @@
+#include <kernel/page_ops.h>
+#include <kernel/paging.h>
+#include <common/inline_assembly.h>
+#include <common/init.h>
+#include <stdio.h>
+
+// Set once the CPU is known to have SSE2
+static uint8_t nontemporal = 0;
+
+// ----------------------------------------
+// String Instruction Variants
+// ----------------------------------------
+
+static void clear_page_rep(void* page){
+  uint32_t count, addr;
+  asm volatile("rep stosl"
+	       : "=&c"(count), "=&D"(addr)
+	       : "a"(0), "0"(PAGE_SIZE / 4), "1"(page)
+	       : "memory");
+}
+
+static void copy_page_rep(void* dst, const void* src){
+  uint32_t count, to, from;
+  asm volatile("rep movsl"
+	       : "=&c"(count), "=&D"(to), "=&S"(from)
+	       : "0"(PAGE_SIZE / 4), "1"(dst), "2"(src)
+	       : "memory");
+}
+
+// ----------------------------------------
+// Non-Temporal Variants
+// ----------------------------------------
+// 16 bytes per iteration; the sfence orders the weakly-ordered stores
+// before anything that follows (e.g. installing the page)
+
+static void clear_page_nt(void* page){
+  uint32_t addr = (uint32_t)page;
+  uint32_t count = PAGE_SIZE / 16;
+  asm volatile("1:\n\t"
+	       "movnti %2, 0(%0)\n\t"
+	       "movnti %2, 4(%0)\n\t"
+	       "movnti %2, 8(%0)\n\t"
+	       "movnti %2, 12(%0)\n\t"
+	       "add $16, %0\n\t"
+	       "dec %1\n\t"
+	       "jnz 1b\n\t"
+	       "sfence"
+	       : "+r"(addr), "+r"(count)
+	       : "r"(0)
+	       : "memory", "cc");
+}
+
+static void copy_page_nt(void* dst, const void* src){
+  uint32_t to = (uint32_t)dst;
+  uint32_t from = (uint32_t)src;
+  uint32_t count = PAGE_SIZE / 16;
+  uint32_t a, b;
+  asm volatile("1:\n\t"
+	       "mov 0(%1), %2\n\t"
+	       "mov 4(%1), %3\n\t"
+	       "movnti %2, 0(%0)\n\t"
+	       "movnti %3, 4(%0)\n\t"
+	       "mov 8(%1), %2\n\t"
+	       "mov 12(%1), %3\n\t"
+	       "movnti %2, 8(%0)\n\t"
+	       "movnti %3, 12(%0)\n\t"
+	       "add $16, %0\n\t"
+	       "add $16, %1\n\t"
+	       "dec %4\n\t"
+	       "jnz 1b\n\t"
+	       "sfence"
+	       : "+r"(to), "+r"(from), "=&r"(a), "=&r"(b), "+r"(count)
+	       :
+	       : "memory", "cc");
+}
+
+// ----------------------------------------
+// Interface
+// ----------------------------------------
+
+void __init setup_page_ops(){
+  uint32_t eax, ebx, ecx, edx;
+  CPUID(0x1, &eax, &ebx, &ecx, &edx);
+  if (edx & CPUID_FEAT_EDX_SSE2){
+    nontemporal = 1;
+    printf("Page ops: non-temporal (SSE2)\n");
+  }
+}
+
+void clear_page(void* page){
+  if (nontemporal){
+    clear_page_nt(page);
+  } else {
+    clear_page_rep(page);
+  }
+}
+
+void copy_page(void* dst, const void* src){
+  if (nontemporal){
+    copy_page_nt(dst, src);
+  } else {
+    copy_page_rep(dst, src);
+  }
+}
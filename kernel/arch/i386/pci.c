@@ -0,0 +1,62 @@
+#include <kernel/pci.h>
+#include <common/inline_assembly.h>
+
+// ----------------------------------------
+// Configuration Space Access
+// ----------------------------------------
+
+static void select_register(pci_device_t* dev, uint8_t offset){
+  uint32_t address = 0x80000000 | ((uint32_t)dev->bus << 16) | ((uint32_t)dev->slot << 11) |
+    ((uint32_t)dev->func << 8) | (offset & 0xFC);
+  outl(PCI_CONFIG_ADDRESS, address);
+}
+
+uint32_t pci_config_read32(pci_device_t* dev, uint8_t offset){
+  select_register(dev, offset);
+  return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(pci_device_t* dev, uint8_t offset){
+  select_register(dev, offset);
+  return inw(PCI_CONFIG_DATA + (offset & 0x2));
+}
+
+void pci_config_write16(pci_device_t* dev, uint8_t offset, uint16_t value){
+  select_register(dev, offset);
+  outw(PCI_CONFIG_DATA + (offset & 0x2), value);
+}
+
+// ----------------------------------------
+// Enumeration
+// ----------------------------------------
+
+int pci_find_device(uint16_t vendor, uint16_t device, uint16_t subsystem, pci_device_t* dev){
+  for (uint32_t bus = 0; bus < 256; bus++){
+    for (uint32_t slot = 0; slot < 32; slot++){
+      for (uint32_t func = 0; func < 8; func++){
+	pci_device_t candidate = { bus, slot, func };
+	uint16_t found_vendor = pci_config_read16(&candidate, PCI_VENDOR_ID);
+	if (found_vendor == PCI_NO_VENDOR){
+	  // No function 0 means no device at all
+	  if (func == 0){
+	    break;
+	  }
+	  continue;
+	}
+
+	if (found_vendor == vendor && pci_config_read16(&candidate, PCI_DEVICE_ID) == device &&
+	    (subsystem == 0xFFFF || pci_config_read16(&candidate, PCI_SUBSYSTEM_ID) == subsystem)){
+	  *dev = candidate;
+	  return 1;
+	}
+
+	// Single-function devices only answer on function 0
+	if (func == 0 && !(pci_config_read16(&candidate, PCI_HEADER_TYPE) & 0x80)){
+	  break;
+	}
+      }
+    }
+  }
+
+  return 0;
+}
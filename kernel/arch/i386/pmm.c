@@ -1,6 +1,14 @@
 #include "kernel/pmm.h"
 #include "string.h"
 #include "common/inline_assembly.h"
+#include "common/init.h"
+#include "kernel/multiboot.h"
+#include "kernel/vmm.h"
+#include "kernel/swap.h"
+#include "kernel/balloon.h"
+#include "kernel/multitasking.h"
+#include "kernel/page_ops.h"
+#include <stdio.h>
 
 // ---------------------
 // Global Frame Data
@@ -12,16 +20,24 @@ extern uint32_t* pmm_frames;
 uint32_t num_frames = 0;
 uint32_t* frames = (uint32_t*)0x0;
 
+// Number of PTEs mapping each frame. Only matters once a frame is
+// shared (copy-on-write); 0 and 1 both mean a single owner
+// Covers low memory at boot; setup_highmem() moves it to a bigger array
+static uint16_t lowmem_frame_refs[LOWMEM_FRAMES];
+static uint16_t* frame_refs = lowmem_frame_refs;
+
+// Frames the idle task zeroed, still marked used
+static uint32_t zeroed_frames[ZEROED_POOL_SIZE];
+static uint32_t num_zeroed = 0;
+
 
 // ----------------------------------------
 // Frame Allocation Helpers
 // ----------------------------------------
 
-static void set_frame(uint32_t frame_addr){
-
-  // We divide memory into 4K chunks
-  // 0x0000 is frame 0, 0x1000 is frame 1...
-  uint32_t frame_number = frame_addr / 0x1000;
+// Frames are numbered, not addressed: with PAE, frame * 0x1000 can
+// be past 4GB. 0x0000 is frame 0, 0x1000 is frame 1...
+static void set_frame(uint32_t frame_number){
 
   // Get index (i.e. which 32-bit bitfield)
   // Get the offset (which bit in bitfield corresponds to frame_number)
@@ -33,9 +49,7 @@ static void set_frame(uint32_t frame_addr){
 }
 
 // Same as set_frame, but clear the bit
-static void clear_frame(uint32_t frame_addr){
-
-  uint32_t frame_number = frame_addr / 0x1000;
+static void clear_frame(uint32_t frame_number){
 
   // Mask is a zero in that slot, and we AND it, e.g. 0b11101111
   uint32_t index = FRAME_BITSET_FROM_ADDR(frame_number);
@@ -45,9 +59,7 @@ static void clear_frame(uint32_t frame_addr){
 }
 
 // Check if a frame is allocated
-static uint32_t test_frame(uint32_t frame_addr){
-
-  uint32_t frame_number = frame_addr / 0x1000;
+static uint32_t test_frame(uint32_t frame_number){
 
   uint32_t index = FRAME_BITSET_FROM_ADDR(frame_number);
   uint32_t offset = FRAME_BIT_OFFSET_FROM_ADDR(frame_number);
@@ -56,12 +68,13 @@ static uint32_t test_frame(uint32_t frame_addr){
 }
 
 // @TODO this is "first fit", maybe implement next-fit
-uint32_t first_frame(){
+static uint32_t scan_first_frame(){
 
   //  breakpoint();
 
   // Use macro for consistency - just get the number of 32-bit bitfields
-  uint32_t num_bitsets = FRAME_BITSET_FROM_ADDR(num_frames);
+  // Low memory only: callers reach the frame through the direct map
+  uint32_t num_bitsets = FRAME_BITSET_FROM_ADDR(LOWMEM_FRAMES);
   
   uint32_t i, j;
   for (i = 0; i < num_bitsets; i++){
@@ -74,7 +87,7 @@ uint32_t first_frame(){
 	if ((frames[i] & mask) == 0){
 	  // Distance into bitset list + distance into this bitset
 	  uint32_t res = (i*32) + j;
-	  set_frame(res * 0x1000);
+	  set_frame(res);
 	  return res;
 	}
       }
@@ -84,6 +97,116 @@ uint32_t first_frame(){
   return (uint32_t)-1;
 }
 
+// Out of memory: hand the pre-zeroed pool back to the bitmap.
+// Returns how many frames that freed
+static uint32_t release_zeroed_frames(){
+  uint32_t released = num_zeroed;
+  for (uint32_t i = 0; i < num_zeroed; i++){
+    clear_frame(zeroed_frames[i]);
+  }
+  num_zeroed = 0;
+  return released;
+}
+
+uint32_t grab_free_frame(){
+  return scan_first_frame();
+}
+
+uint32_t first_frame(){
+  uint32_t res = scan_first_frame();
+
+  // Out of memory: take back the zeroed pool, pages from the balloon or
+  // the task pool, or else push some cold pages out to swap, and try again
+  if (res == (uint32_t)-1 && (release_zeroed_frames() || balloon_deflate_on_oom(RECLAIM_BATCH) || trim_task_pool(RECLAIM_BATCH) || reclaim_pages(RECLAIM_BATCH))){
+    res = scan_first_frame();
+  }
+
+  return res;
+}
+
+// One pass over the bitmap for up to count free frames
+static uint32_t scan_frames(uint32_t* frame_indices, uint32_t count, int highmem_ok){
+
+  uint32_t lowmem_bitsets = FRAME_BITSET_FROM_ADDR(LOWMEM_FRAMES);
+  uint32_t num_bitsets = FRAME_BITSET_FROM_ADDR(num_frames);
+  uint32_t found = 0;
+
+  // Prefer high memory when allowed, and keep low memory for the
+  // things that need it. Wraps around into low memory after
+  uint32_t first = (highmem_ok && num_bitsets > lowmem_bitsets) ? lowmem_bitsets : 0;
+  if (!highmem_ok){
+    num_bitsets = lowmem_bitsets;
+  }
+
+  uint32_t n, i, j;
+  for (n = 0; n < num_bitsets && found < count; n++){
+    i = first + n;
+    if (i >= num_bitsets){
+      i -= num_bitsets;
+    }
+
+    // All bits set means none available in this set
+    if (frames[i] == 0xFFFFFFFF){
+      continue;
+    }
+
+    for (j = 0; j < 32 && found < count; j++){
+      uint32_t mask = 0x1 << j;
+      if ((frames[i] & mask) == 0){
+	frames[i] |= mask;
+	frame_indices[found++] = (i*32) + j;
+      }
+    }
+  }
+
+  return found;
+}
+
+// Grab up to count free frames, reclaiming if memory runs short
+// Frame indices go in frame_indices; returns how many were found
+uint32_t alloc_frames(uint32_t* frame_indices, uint32_t count, int highmem_ok){
+  uint32_t found = scan_frames(frame_indices, count, highmem_ok);
+
+  uint32_t short_by = count - found;
+  if (found < count && (release_zeroed_frames() || balloon_deflate_on_oom(short_by) || trim_task_pool(short_by) || reclaim_pages(short_by))){
+    found += scan_frames(&frame_indices[found], count - found, highmem_ok);
+  }
+
+  return found;
+}
+
+int zero_idle_frame(){
+  lock_scheduler();
+  uint32_t frame = (uint32_t)-1;
+  if (num_zeroed < ZEROED_POOL_SIZE){
+    // Straight from the bitmap: idle work mustn't push anything out
+    frame = scan_first_frame();
+  }
+  unlock_scheduler();
+
+  if (frame == (uint32_t)-1){
+    return 0;
+  }
+
+  // The frame is ours already, so clear it with IRQs on
+  clear_page(phys_to_virt(frame * FRAME_SIZE));
+
+  lock_scheduler();
+  zeroed_frames[num_zeroed++] = frame;
+  unlock_scheduler();
+  return 1;
+}
+
+uint32_t take_zeroed_frames(uint32_t* frame_indices, uint32_t count){
+  lock_scheduler();
+  uint32_t taken = 0;
+  while (taken < count && num_zeroed){
+    frame_indices[taken++] = zeroed_frames[--num_zeroed];
+  }
+  unlock_scheduler();
+  return taken;
+}
+
 // ----------------------------------------
 // Page Allocation & De-Allocation
 // ----------------------------------------
@@ -103,13 +226,14 @@ void alloc_frame(page_t* page, int is_kernel, int is_writeable){
   }
   
   // Mark this physical frame as allocated
-  set_frame(frame_index * 0x1000);
+  set_frame(frame_index);
 
   // Set page attributes
   page->present = 1;
   page->rw = (is_writeable) ? 1 : 0;
   page->user = (is_kernel) ? 0 : 1;
   page->frame = frame_index;
+  frame_refs[frame_index] = 1;
 }
 
 void free_frame(page_t* page){
@@ -119,18 +243,96 @@ void free_frame(page_t* page){
     return;
   }
 
+  // Frame still mapped elsewhere; just drop this reference
+  if (frame_refs[page->frame] > 1){
+    frame_refs[page->frame]--;
+    page->frame = 0x0;
+    return;
+  }
+
   // Mark physical page as available
   // Clear our this page's frame
-  clear_frame(page->frame * 0x1000);
+  // Its contents are gone, so any copy kept in swap goes too
+  swap_forget_frame(page->frame);
+  frame_refs[page->frame] = 0;
+  clear_frame(page->frame);
   page->frame = 0x0;
 }
 
+// For frames not tracked by a PTE (page tables, directories)
+// These always come from low memory
+void free_phys_frame(uint32_t frame_addr){
+  if (frame_addr == 0){
+    return;
+  }
+
+  clear_frame(frame_addr / FRAME_SIZE);
+}
+
+// Another PTE is about to map the same frame as page
+void share_frame(page_t* page){
+  if (!page || (page->frame == 0)){
+    return;
+  }
+
+  uint32_t refs = frame_refs[page->frame];
+  frame_refs[page->frame] = (refs ? refs : 1) + 1;
+}
+
+uint32_t frame_ref_count(uint32_t frame_index){
+  uint32_t refs = frame_refs[frame_index];
+  return refs ? refs : 1;
+}
+
+// Scans low memory only; callers want the run through the direct map
+uint32_t alloc_contiguous_frames(uint32_t count){
+  uint32_t run = 0;
+  for (uint32_t i = 0; i < LOWMEM_FRAMES; i++){
+    if (test_frame(i)){
+      run = 0;
+      continue;
+    }
+
+    if (++run == count){
+      uint32_t first = i + 1 - count;
+      for (uint32_t j = first; j <= i; j++){
+	set_frame(j);
+      }
+      return first;
+    }
+  }
+
+  return (uint32_t)-1;
+}
+
+// Free frames handed out by alloc_frames / alloc_contiguous_frames.
+// Takes frame numbers, so high memory works too
+void free_frames(uint32_t* frame_indices, uint32_t count){
+  for (uint32_t i = 0; i < count; i++){
+    clear_frame(frame_indices[i]);
+  }
+}
+
+uint32_t count_free_frames(){
+  uint32_t num_bitsets = FRAME_BITSET_FROM_ADDR(num_frames);
+  uint32_t free = 0;
+  for (uint32_t i = 0; i < num_bitsets; i++){
+    // Clear the lowest set bit until none are left
+    uint32_t used = 0;
+    for (uint32_t bits = frames[i]; bits; bits &= bits - 1){
+      used++;
+    }
+    free += 32 - used;
+  }
+  return free;
+}
+
 
 // ----------------
 // Setup
 // ----------------
 
-void setup_pmm(){
+void __init setup_pmm(){
 
   
   frames = pmm_frames;  
@@ -144,3 +346,96 @@ void setup_pmm(){
   // Set the rest as free: 124MB
   memset(&frames[32], 0x0, 3968);
 }
+
+#ifdef PAE
+
+// ----------------
+// High Memory
+// ----------------
+
+void __init setup_highmem(){
+
+  multiboot_info_t* mbi = (multiboot_info_t*)phys_to_virt(multiboot_info);
+  if (!multiboot_info || !(mbi->flags & MULTIBOOT_INFO_MEM_MAP)){
+    printf("PMM: no memory map; high memory unused\n");
+    return;
+  }
+  uint32_t mmap_start = mbi->mmap_addr;
+  uint32_t mmap_end = mbi->mmap_addr + mbi->mmap_length;
+
+  // Top of usable RAM, as far as PAE reaches
+  uint64_t top = 0;
+  for (uint32_t addr = mmap_start; addr < mmap_end; ){
+    multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)phys_to_virt(addr);
+    addr += entry->size + sizeof(entry->size);
+
+    uint64_t end = entry->addr + entry->len;
+    if (entry->type != MULTIBOOT_MEMORY_AVAILABLE){
+      continue;
+    }
+    if (end > MAX_PHYS_ADDR){
+      end = MAX_PHYS_ADDR;
+    }
+    if (end > top){
+      top = end;
+    }
+  }
+  if (top <= PHYSICAL_MEM_SIZE){
+    return;
+  }
+
+  // Whole bitsets, so the scans never look at a partial word
+  uint32_t total_frames = (uint32_t)(top >> 12);
+  total_frames = (total_frames + 31) & ~31;
+
+  // One bit and one refcount per frame, carved out of low memory
+  uint32_t bitmap_pages = ((total_frames / 8) + FRAME_SIZE - 1) / FRAME_SIZE;
+  uint32_t refs_pages = ((total_frames * sizeof(uint16_t)) + FRAME_SIZE - 1) / FRAME_SIZE;
+  uint32_t bitmap_first = alloc_contiguous_frames(bitmap_pages);
+  uint32_t refs_first = alloc_contiguous_frames(refs_pages);
+  if (bitmap_first == (uint32_t)-1 || refs_first == (uint32_t)-1){
+    printf("PMM: no room to track high memory\n");
+    return;
+  }
+
+  uint32_t* new_frames = (uint32_t*)phys_to_virt(bitmap_first * FRAME_SIZE);
+  uint16_t* new_refs = (uint16_t*)phys_to_virt(refs_first * FRAME_SIZE);
+
+  // Low memory carries over as is; high memory starts out all used
+  memcpy(new_frames, frames, LOWMEM_FRAMES / 8);
+  memset(&new_frames[LOWMEM_FRAMES / 32], 0xFF, (total_frames - LOWMEM_FRAMES) / 8);
+  memcpy(new_refs, frame_refs, LOWMEM_FRAMES * sizeof(uint16_t));
+  memset(&new_refs[LOWMEM_FRAMES], 0x0, (total_frames - LOWMEM_FRAMES) * sizeof(uint16_t));
+
+  frames = new_frames;
+  frame_refs = new_refs;
+  num_frames = total_frames;
+
+  // Then free whatever the map calls usable RAM
+  uint32_t num_free = 0;
+  for (uint32_t addr = mmap_start; addr < mmap_end; ){
+    multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)phys_to_virt(addr);
+    addr += entry->size + sizeof(entry->size);
+    if (entry->type != MULTIBOOT_MEMORY_AVAILABLE){
+      continue;
+    }
+
+    uint64_t start = (entry->addr + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+    uint64_t end = (entry->addr + entry->len) & ~(uint64_t)(FRAME_SIZE - 1);
+    if (start < PHYSICAL_MEM_SIZE){
+      start = PHYSICAL_MEM_SIZE;
+    }
+    if (end > top){
+      end = top;
+    }
+
+    for (uint32_t f = (uint32_t)(start >> 12); f < (uint32_t)(end >> 12); f++){
+      clear_frame(f);
+      num_free++;
+    }
+  }
+
+  printf("PMM: %d MB of high memory\n", num_free >> 8);
+}
+
+#endif // PAE
@@ -2,6 +2,7 @@
 #include "common/inline_assembly.h"
 #include "stdio.h"
 #include "kernel/PIC.h"
+#include "common/init.h"
 
 
 uint8_t read_data_port(){
@@ -10,30 +11,30 @@ uint8_t read_data_port(){
   return result;
 }
 
-void write_data_port(uint8_t val){
+void __init write_data_port(uint8_t val){
   WAIT_FOR_WRITE();
   outb(PS2_DATA_PORT, val);
 }
 
-uint8_t read_status_register(){
+uint8_t __init read_status_register(){
   WAIT_FOR_READ();
   uint8_t result = inb(PS2_STAT_REG);
   return result;
 }
 
-void write_command_register(uint8_t val){
+void __init write_command_register(uint8_t val){
   WAIT_FOR_WRITE();
   outb(PS2_CMD_REG, val);
 }
 
-void flush_output_buffer(){
+void __init flush_output_buffer(){
   // Do a couple of dummy data reads
   for (int i = 0; i < 3; i++){
     read_data_port();
   }
 }
 
-void cmd_dev_port(uint8_t command, uint8_t device){
+void __init cmd_dev_port(uint8_t command, uint8_t device){
   // Sanity check
   if (device > 0x2){
     printf("Error - unknown device\n");
@@ -45,7 +46,7 @@ void cmd_dev_port(uint8_t command, uint8_t device){
   write_data_port(command);
 }
 
-uint8_t enable_scanning(uint8_t device){
+uint8_t __init enable_scanning(uint8_t device){
 
   cmd_dev_port(ENABLE_SCANNING, device);
 
@@ -60,7 +61,7 @@ uint8_t enable_scanning(uint8_t device){
   return ack;
 }
 
-uint16_t identify_device(uint8_t device){
+uint16_t __init identify_device(uint8_t device){
   // Do some dummy reads
   flush_output_buffer();
 
@@ -104,7 +105,7 @@ uint16_t identify_device(uint8_t device){
   return deviceID;
 }
 
-void initialize_ps2_controller(){
+void __init initialize_ps2_controller(){
 
   // Disable devices
   flush_output_buffer();
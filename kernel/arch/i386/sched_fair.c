@@ -0,0 +1,292 @@
+#include <kernel/sched_fair.h>
+#include <kernel/multitasking.h>
+#include <kernel/timer.h>
+#include <stdio.h>
+
+// Weight of each nice level, NICE_MIN first. Neighbouring levels are
+// about 1.25x apart, so one step moves a task's share by about 10%
+static const uint32_t nice_weights[NICE_MAX - NICE_MIN + 1] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+  9548,  7620,  6100,  4904,  3906,
+  3121,  2501,  1991,  1586,  1277,
+  1024,  820,   655,   526,   423,
+  335,   272,   215,   172,   137,
+  110,   87,    70,    56,    45,
+  36,    29,    23,    18,    15,
+};
+
+// Ready fair tasks, ordered by vruntime
+static tcb_t* fair_root = 0;
+static uint32_t fair_nr_queued = 0;
+static uint32_t fair_queued_weight = 0;
+
+// Never goes backwards. Waking and new tasks start near it, so a task
+// that slept for a long time can't then hog the CPU to catch up
+static uint64_t min_vruntime = 0;
+
+// ------------------------------------
+// AVL Helpers
+// ------------------------------------
+
+// Ties on vruntime go by task id, so every key is unique
+static int fair_before(tcb_t* a, tcb_t* b){
+  if (a->vruntime != b->vruntime){
+    return a->vruntime < b->vruntime;
+  }
+  return a->task_id < b->task_id;
+}
+
+static int32_t height(tcb_t* node){
+  return node ? node->fair_height : 0;
+}
+
+static void update_height(tcb_t* node){
+  int32_t hl = height(node->fair_left);
+  int32_t hr = height(node->fair_right);
+  node->fair_height = ((hl > hr) ? hl : hr) + 1;
+}
+
+static tcb_t* rotate_right(tcb_t* node){
+  tcb_t* pivot = node->fair_left;
+  node->fair_left = pivot->fair_right;
+  pivot->fair_right = node;
+  update_height(node);
+  update_height(pivot);
+  return pivot;
+}
+
+static tcb_t* rotate_left(tcb_t* node){
+  tcb_t* pivot = node->fair_right;
+  node->fair_right = pivot->fair_left;
+  pivot->fair_left = node;
+  update_height(node);
+  update_height(pivot);
+  return pivot;
+}
+
+static tcb_t* rebalance(tcb_t* node){
+  update_height(node);
+  int32_t balance = height(node->fair_left) - height(node->fair_right);
+
+  // Left heavy
+  if (balance > 1){
+    if (height(node->fair_left->fair_left) < height(node->fair_left->fair_right)){
+      node->fair_left = rotate_left(node->fair_left);
+    }
+    return rotate_right(node);
+  }
+
+  // Right heavy
+  if (balance < -1){
+    if (height(node->fair_right->fair_right) < height(node->fair_right->fair_left)){
+      node->fair_right = rotate_right(node->fair_right);
+    }
+    return rotate_left(node);
+  }
+
+  return node;
+}
+
+static tcb_t* insert_node(tcb_t* root, tcb_t* node){
+  if (!root){
+    return node;
+  }
+
+  if (fair_before(node, root)){
+    root->fair_left = insert_node(root->fair_left, node);
+  } else {
+    root->fair_right = insert_node(root->fair_right, node);
+  }
+  return rebalance(root);
+}
+
+// Unlink the leftmost node of a subtree, handing it back in *min
+static tcb_t* remove_min(tcb_t* root, tcb_t** min){
+  if (!root->fair_left){
+    *min = root;
+    return root->fair_right;
+  }
+
+  root->fair_left = remove_min(root->fair_left, min);
+  return rebalance(root);
+}
+
+static tcb_t* remove_node(tcb_t* root, tcb_t* node){
+  if (!root){
+    return 0;
+  }
+
+  if (node == root){
+    if (!root->fair_left || !root->fair_right){
+      return root->fair_left ? root->fair_left : root->fair_right;
+    }
+
+    // Two children: the in-order successor takes this node's place
+    tcb_t* successor;
+    tcb_t* right = remove_min(root->fair_right, &successor);
+    successor->fair_left = root->fair_left;
+    successor->fair_right = right;
+    return rebalance(successor);
+  }
+
+  if (fair_before(node, root)){
+    root->fair_left = remove_node(root->fair_left, node);
+  } else {
+    root->fair_right = remove_node(root->fair_right, node);
+  }
+  return rebalance(root);
+}
+
+// ------------------------------------
+// Fair Class
+// ------------------------------------
+
+static void update_min_vruntime(tcb_t* curr){
+  uint64_t vruntime = min_vruntime;
+  int found = 0;
+
+  if (curr && curr->priority == PRIORITY_NORMAL && curr->state == TASK_RUNNING){
+    vruntime = curr->vruntime;
+    found = 1;
+  }
+
+  tcb_t* first = fair_first();
+  if (first && (!found || first->vruntime < vruntime)){
+    vruntime = first->vruntime;
+    found = 1;
+  }
+
+  if (found && vruntime > min_vruntime){
+    min_vruntime = vruntime;
+  }
+}
+
+void fair_init_task(tcb_t* task){
+  task->nice = 0;
+  task->weight = NICE_0_WEIGHT;
+  task->vruntime = min_vruntime;
+  task->exec_start = ms_since_boot();
+  task->fair_left = 0;
+  task->fair_right = 0;
+  task->fair_height = 1;
+}
+
+// Slices are only ended by a timer tick, so none is shorter than one
+static uint32_t fair_granularity(){
+  uint32_t tick = (uint32_t)ms_per_tick();
+  return (tick > SCHED_MIN_GRANULARITY_MS) ? tick : SCHED_MIN_GRANULARITY_MS;
+}
+
+static uint32_t fair_latency(){
+  uint32_t granularity = fair_granularity();
+  return (granularity > SCHED_LATENCY_MS) ? granularity : SCHED_LATENCY_MS;
+}
+
+void fair_place_task(tcb_t* task){
+  uint64_t floor = min_vruntime;
+  uint64_t credit = (fair_latency() * 1000) / 2;
+  floor = (floor > credit) ? floor - credit : 0;
+  if (task->vruntime < floor){
+    task->vruntime = floor;
+  }
+}
+
+void fair_enqueue(tcb_t* task){
+  // Waking, new, or moved here from another level. The running task
+  // (being put back) keeps its own
+  if (task != curr_tcb){
+    fair_place_task(task);
+  }
+
+  task->fair_left = 0;
+  task->fair_right = 0;
+  task->fair_height = 1;
+  fair_root = insert_node(fair_root, task);
+
+  fair_nr_queued++;
+  fair_queued_weight += task->weight;
+}
+
+void fair_dequeue(tcb_t* task){
+  fair_root = remove_node(fair_root, task);
+  task->fair_left = 0;
+  task->fair_right = 0;
+
+  fair_nr_queued--;
+  fair_queued_weight -= task->weight;
+}
+
+tcb_t* fair_first(){
+  tcb_t* node = fair_root;
+  while (node && node->fair_left){
+    node = node->fair_left;
+  }
+  return node;
+}
+
+void fair_update_curr(tcb_t* task){
+  uint64_t now = ms_since_boot();
+  uint64_t delta_ms = now - task->exec_start;
+  task->exec_start = now;
+
+  if (task->priority != PRIORITY_NORMAL){
+    return;
+  }
+
+  // vruntime is in microseconds at nice 0, so heavier tasks age slower.
+  // Capping one charge at a second keeps the scaling in 32 bits
+  uint32_t delta_us = (delta_ms > 1000) ? 1000000 : (uint32_t)delta_ms * 1000;
+  task->vruntime += (delta_us * NICE_0_WEIGHT) / task->weight;
+
+  update_min_vruntime(task);
+}
+
+uint32_t fair_time_slice(tcb_t* task){
+  // The task itself plus whatever it shares the CPU with
+  uint32_t nr_running = fair_nr_queued + 1;
+  uint32_t total_weight = fair_queued_weight + task->weight;
+
+  uint32_t granularity = fair_granularity();
+  uint32_t period = fair_latency();
+  if (nr_running * granularity > period){
+    period = nr_running * granularity;
+  }
+
+  // Its share of the period, by weight
+  uint32_t slice = (period * task->weight) / total_weight;
+  if (slice < granularity){
+    slice = granularity;
+  }
+
+  // The timer takes a whole tick off at a time
+  uint32_t tick = (uint32_t)ms_per_tick();
+  if (tick){
+    slice = ((slice + tick - 1) / tick) * tick;
+  }
+  return slice;
+}
+
+void set_task_nice(tcb_t* task, int8_t nice){
+  if (nice < NICE_MIN || nice > NICE_MAX){
+    printf("Nice must be %d to %d\n", NICE_MIN, NICE_MAX);
+    return;
+  }
+
+  lock_scheduler();
+
+  // Queued weight is summed, so take it out while the weight changes
+  int queued = (task->state == TASK_READY && task->priority == PRIORITY_NORMAL);
+  if (queued){
+    fair_dequeue(task);
+  }
+
+  task->nice = nice;
+  task->weight = nice_weights[nice - NICE_MIN];
+
+  if (queued){
+    fair_enqueue(task);
+  }
+
+  unlock_scheduler();
+}
@@ -23,6 +23,7 @@ void add_to_sleep_queue(sleeping_task_t* sleeper){
   if (sleeper->wake_time < sleep_queue_head->wake_time){
     sleeper->next = sleep_queue_head;
     sleep_queue_head = sleeper;
+    return;
   }
 
   // Search until we find a node where the next node's val is greater than the new node
@@ -71,7 +72,7 @@ void ms_sleep_until(uint64_t wake_time_ms){
 void ms_sleep(uint64_t sleep_duration){
   uint64_t current_time = ms_since_boot();
   uint64_t wake_time_ms = current_time + sleep_duration;
-  printf("Current time: %d -- Sleep until: %d\n", (uint32_t)current_time, (uint32_t)wake_time_ms);
+  //printf("Current time: %d -- Sleep until: %d\n", (uint32_t)current_time, (uint32_t)wake_time_ms);
   ms_sleep_until(wake_time_ms);
 }
 
@@ -87,7 +88,7 @@ void wake_sleeping_tasks(){
   // For all sleeping tasks, unblock them (no pre-empting), remove the node from the queue
   // Update sleep list, and de-allocate now-unused links
   while (sleep_queue_head && sleep_queue_head->wake_time <= time_millis){
-    printf("wake_sleeping_task %d at %d\n", sleep_queue_head->task->task_id, time_millis);
+    //printf("wake_sleeping_task %d at %d\n", sleep_queue_head->task->task_id, time_millis);
     unblock_task(sleep_queue_head->task, 0);
     sleeping_task_t* to_delete = sleep_queue_head;
     sleep_queue_head = sleep_queue_head->next;
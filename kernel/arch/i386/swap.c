@@ -0,0 +1,120 @@
+#include <kernel/swap.h>
+#include <kernel/zram.h>
+#include <kernel/vmm.h>
+#include <kernel/pmm.h>
+#include <string.h>
+#include <stdio.h>
+
+// Device evicted pages go to; 0 until setup_swap()
+static swap_device_t* swap_device = 0;
+
+// References to each slot (see swap.h). As wide as frame_refs, so
+// clones sharing a swapped-out page can't wrap it
+static uint16_t slot_refs[SWAP_MAX_SLOTS];
+
+// Where the last slot search stopped
+static uint32_t slot_hint = 1;
+
+// Swap cache: slot matching each low-memory frame, 0 for none
+// Pages are only ever swapped in to low memory
+static uint16_t frame_slot[LOWMEM_FRAMES];
+
+// ----------------------------------
+// Setup
+// ----------------------------------
+
+void setup_swap(){
+  swap_device = setup_zram();
+  if (!swap_device){
+    printf("Swap: no device\n");
+    return;
+  }
+
+  if (swap_device->num_slots > SWAP_MAX_SLOTS){
+    swap_device->num_slots = SWAP_MAX_SLOTS;
+  }
+  printf("Swap: %d slots on %s\n", swap_device->num_slots - 1, swap_device->name);
+}
+
+int swap_enabled(){
+  return swap_device != 0;
+}
+
+// ----------------------------------
+// Slots
+// ----------------------------------
+
+uint32_t swap_alloc_slot(){
+  if (!swap_device){
+    return 0;
+  }
+
+  uint32_t num_slots = swap_device->num_slots;
+  for (uint32_t n = 1; n < num_slots; n++){
+    uint32_t slot = slot_hint + n;
+    if (slot >= num_slots){
+      slot -= num_slots - 1;
+    }
+
+    if (!slot_refs[slot]){
+      slot_refs[slot] = 1;
+      slot_hint = slot;
+      return slot;
+    }
+  }
+
+  return 0;
+}
+
+void swap_dup_slot(uint32_t slot){
+  if (slot){
+    slot_refs[slot]++;
+  }
+}
+
+void swap_free_slot(uint32_t slot){
+  if (slot && slot_refs[slot]){
+    slot_refs[slot]--;
+
+    // Let the device reuse the space straight away
+    if (!slot_refs[slot] && swap_device->free_page){
+      swap_device->free_page(slot);
+    }
+  }
+}
+
+uint32_t swap_slot_refs(uint32_t slot){
+  return slot_refs[slot];
+}
+
+int swap_read_page(uint32_t slot, void* dst){
+  return swap_device->read_page(slot, dst);
+}
+
+int swap_write_page(uint32_t slot, const void* src){
+  return swap_device->write_page(slot, src);
+}
+
+// ----------------------------------
+// Swap Cache
+// ----------------------------------
+
+void swap_cache_add(uint32_t frame_index, uint32_t slot){
+  if (frame_index < LOWMEM_FRAMES){
+    frame_slot[frame_index] = slot;
+  }
+}
+
+uint32_t swap_cache_take(uint32_t frame_index){
+  if (frame_index >= LOWMEM_FRAMES){
+    return 0;
+  }
+
+  uint32_t slot = frame_slot[frame_index];
+  frame_slot[frame_index] = 0;
+  return slot;
+}
+
+void swap_forget_frame(uint32_t frame_index){
+  swap_free_slot(swap_cache_take(frame_index));
+}
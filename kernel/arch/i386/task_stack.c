@@ -0,0 +1,141 @@
+#include <kernel/task_stack.h>
+#include <kernel/vma.h>
+#include <kernel/vmm.h>
+#include <kernel/pmm.h>
+#include <kernel/page_ops.h>
+#include <kernel/tss.h>
+#include <kernel/multitasking.h>
+#include <common/init.h>
+#include <common/inline_assembly.h>
+#include <stdio.h>
+
+// grow_task_stack runs in the double-fault task, possibly in the middle
+// of a PMM scan or a table-count update, so it can touch neither. Each
+// reserve slot holds a frame or 0, and its grown slot the page mapped
+// with that frame, not yet counted, or 0. The double-fault side only
+// empties reserve slots and fills grown ones, a single instruction
+// each, and the refill only fills a reserve slot once its grown slot is
+// settled; so an interrupted refill never loses track of either
+static volatile uint32_t stack_reserve[TASK_STACK_RESERVE];
+static volatile uint32_t stack_grown[TASK_STACK_RESERVE];
+
+void __init setup_task_stacks(){
+  // Stacks live in the shared kernel half, so the kernel directory
+  // sees every one of them
+  double_fault_tss.cr3 = kernel_mm.pgdir;
+
+  refill_stack_reserve();
+}
+
+void refill_stack_reserve(){
+  lock_scheduler();
+
+  for (uint32_t i = 0; i < TASK_STACK_RESERVE; i++){
+    uint32_t grown = XCHG(&stack_grown[i], 0);
+    if (grown){
+      count_kernel_page(grown);
+    }
+
+    if (!stack_reserve[i]){
+      uint32_t frame = grab_free_frame();
+      if (frame != (uint32_t)-1){
+	stack_reserve[i] = frame;
+      }
+    }
+  }
+
+  unlock_scheduler();
+}
+
+uint32_t alloc_task_stack(){
+
+  lock_scheduler();
+
+  // Room for the stack plus the guard page below it, which it would
+  // overflow into
+  uint32_t start = find_vma_gap(kernel_vmas, TASK_STACK_START, TASK_STACK_END, TASK_STACK_SIZE + PAGE_SIZE);
+  vma_t* vma = 0;
+  if (start){
+    start += PAGE_SIZE;
+    vma = insert_vma(&kernel_vmas, start, start + TASK_STACK_SIZE, VMA_READ | VMA_WRITE, VMA_DEMAND | VMA_GUARD, VMA_STACK);
+  }
+
+  unlock_scheduler();
+
+  if (!vma){
+    printf("No room for a task stack\n");
+    return 0;
+  }
+
+  // The first switch to the task pops its initial frame off the top page
+  uint32_t top = vma->end;
+  if (!map_range(top - PAGE_SIZE, 0, 1, MAP_WRITE | MAP_ALLOC)){
+    free_task_stack(top);
+    return 0;
+  }
+
+  // One more stack that may need to grow
+  refill_stack_reserve();
+
+  return top;
+}
+
+void free_task_stack(uint32_t top){
+  uint32_t start = top - TASK_STACK_SIZE;
+
+  lock_scheduler();
+
+  vma_t* vma = find_vma(kernel_vmas, start);
+  if (!vma || vma->start != start || vma->backing != VMA_STACK){
+    unlock_scheduler();
+    printf("free_task_stack: %x is not a task stack\n", top);
+    return;
+  }
+
+  // Release whatever the task grew into, counted first
+  refill_stack_reserve();
+  unmap_range(vma->start, TASK_STACK_SIZE / PAGE_SIZE, MAP_ALLOC);
+
+  remove_vma(&kernel_vmas, start);
+
+  unlock_scheduler();
+}
+
+int grow_task_stack(uint32_t addr){
+  if (addr < TASK_STACK_START || addr >= TASK_STACK_END){
+    return 0;
+  }
+
+  vma_t* vma = find_vma(kernel_vmas, addr);
+  if (!vma || vma->backing != VMA_STACK){
+    return 0;
+  }
+
+  // Already mapped: whatever went wrong, it wasn't a missing page
+  uint32_t page_addr = addr & 0xFFFFF000;
+  page_t* page = get_page(page_addr, 0);
+  if (!page || page->present){
+    return 0;
+  }
+
+  // The faulting task may hold the scheduler lock, or be halfway
+  // through the PMM: only the reserve is safe to take from (see above)
+  uint32_t i;
+  uint32_t frame = 0;
+  for (i = 0; i < TASK_STACK_RESERVE && !frame; i++){
+    frame = XCHG(&stack_reserve[i], 0);
+  }
+  if (!frame){
+    return 0;
+  }
+  i--;
+
+  if (!map_kernel_page_nolock(page_addr, frame)){
+    stack_reserve[i] = frame;
+    return 0;
+  }
+  stack_grown[i] = page_addr;
+
+  clear_page((void*)page_addr);
+  return 1;
+}
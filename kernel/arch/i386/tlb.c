@@ -0,0 +1,115 @@
+#include <kernel/tlb.h>
+#include <kernel/paging.h>
+#include <common/inline_assembly.h>
+#include <common/init.h>
+
+// Set once CR4.PGE is on; kernel-half PTEs are then global
+static uint8_t global_pages_enabled = 0;
+
+// ----------------------------------------
+// Setup
+// ----------------------------------------
+
+uint32_t __init enable_global_pages(){
+  uint32_t eax, ebx, ecx, edx;
+  CPUID(0x1, &eax, &ebx, &ecx, &edx);
+  if (!(edx & CPUID_FEAT_EDX_PGE)){
+    return 0;
+  }
+
+  WRITE_CR4(READ_CR4() | CR4_PGE);
+  global_pages_enabled = 1;
+  return 1;
+}
+
+// ----------------------------------------
+// Single Page / Range Invalidation
+// ----------------------------------------
+
+void flush_tlb_page(uint32_t vaddr){
+  INVLPG(vaddr & 0xFFFFF000);
+}
+
+// Invalidate every page in [start, end)
+void flush_tlb_range(uint32_t start, uint32_t end){
+  start &= 0xFFFFF000;
+  if (end <= start){
+    return;
+  }
+
+  uint32_t num_pages = (end - start + PAGE_SIZE - 1) / PAGE_SIZE;
+  if (num_pages > TLB_FLUSH_ALL_THRESHOLD){
+    // A CR3 reload leaves global (kernel) entries behind
+    if (end > KERNEL_VIRTUAL_BASE){
+      flush_tlb_global();
+    } else {
+      flush_tlb_all();
+    }
+    return;
+  }
+
+  for (uint32_t addr = start; addr < end; addr += PAGE_SIZE){
+    INVLPG(addr);
+  }
+}
+
+// Reload CR3 to drop every (non-global) translation
+void flush_tlb_all(){
+  uint32_t cr3;
+  asm volatile("mov %%cr3, %0" : "=r"(cr3));
+  asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+// Drop global translations too: toggling CR4.PGE flushes everything
+// Only needed when kernel-half mappings change in bulk
+void flush_tlb_global(){
+  if (!global_pages_enabled){
+    flush_tlb_all();
+    return;
+  }
+
+  uint32_t cr4 = READ_CR4();
+  WRITE_CR4(cr4 & ~CR4_PGE);
+  WRITE_CR4(cr4);
+}
+
+// ----------------------------------------
+// Batched Invalidation
+// ----------------------------------------
+
+void tlb_batch_init(tlb_batch_t* batch){
+  batch->count = 0;
+  batch->overflow = 0;
+  batch->kernel = 0;
+}
+
+void tlb_batch_add(tlb_batch_t* batch, uint32_t vaddr){
+  if (vaddr >= KERNEL_VIRTUAL_BASE){
+    batch->kernel = 1;
+  }
+
+  if (batch->overflow){
+    return;
+  }
+
+  if (batch->count == TLB_BATCH_MAX){
+    batch->overflow = 1;
+    return;
+  }
+
+  batch->addrs[batch->count++] = vaddr & 0xFFFFF000;
+}
+
+void tlb_batch_flush(tlb_batch_t* batch){
+  if (batch->overflow && batch->kernel){
+    flush_tlb_global();
+  } else if (batch->overflow){
+    flush_tlb_all();
+  } else {
+    for (uint32_t i = 0; i < batch->count; i++){
+      INVLPG(batch->addrs[i]);
+    }
+  }
+
+  tlb_batch_init(batch);
+}
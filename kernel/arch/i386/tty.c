@@ -5,6 +5,7 @@
 #include <common/inline_assembly.h>
  
 #include <kernel/tty.h>
+#include <kernel/ioremap.h>
  
 #include "vga.h"
  
@@ -12,6 +13,7 @@
 #define VGA_HEIGHT 25
 #define LAST_ROW   VGA_HEIGHT - 1
 static uint16_t* const VGA_MEMORY = (uint16_t*) 0xC00B8000;
+#define VGA_PHYS   0xB8000
  
 static size_t terminal_row;
 static size_t terminal_column;
@@ -103,6 +105,17 @@ void terminal_initialize(void) {
   }
 }
  
+// Move output to a write-combining mapping of the text buffer, so a
+// redraw goes out in bursts instead of one uncached store per cell.
+// Needs vmalloc space; until then the boot mapping is used. The
+// buffer is only ever written, never read back
+void terminal_map_write_combining(void) {
+  uint16_t* wc_buffer = ioremap_wc(VGA_PHYS, VGA_WIDTH * VGA_HEIGHT * sizeof(uint16_t));
+  if (wc_buffer) {
+    terminal_buffer = wc_buffer;
+  }
+}
+
 void terminal_setcolor(uint8_t color) {
   terminal_color = color;
 }
@@ -0,0 +1,95 @@
+#include <kernel/uaccess.h>
+#include <kernel/paging.h>
+
+// Bounds of the linked exception table
+extern exception_entry_t _ex_table_start[];
+extern exception_entry_t _ex_table_end[];
+
+// The range lies wholly in the user half
+static inline int user_range_ok(const void* addr, uint32_t n){
+  return n <= KERNEL_VIRTUAL_BASE && (uint32_t)addr <= KERNEL_VIRTUAL_BASE - n;
+}
+
+// rep movs, dwords then the odd bytes. Either one may fault; the fixup
+// (out of line, in .fixup) sets the result and skips to the end
+static int copy_user(void* to, const void* from, uint32_t n){
+  int err = 0;
+  uint32_t d0, d1, d2;
+  asm volatile("1: rep movsl\n"
+	       "   movl %[rem], %%ecx\n"
+	       "2: rep movsb\n"
+	       "3:\n"
+	       ".section .fixup, \"ax\"\n"
+	       "4: movl %[efault], %[err]\n"
+	       "   jmp 3b\n"
+	       ".previous\n"
+	       ".section __ex_table, \"a\"\n"
+	       "   .long 1b, 4b\n"
+	       "   .long 2b, 4b\n"
+	       ".previous\n"
+	       : [err] "+r"(err), "=&c"(d0), "=&D"(d1), "=&S"(d2)
+	       : "1"(n / 4), [rem] "r"(n & 3), "2"(to), "3"(from), [efault] "i"(-EFAULT)
+	       : "memory");
+  return err;
+}
+
+int copy_from_user(void* to, const void* from, uint32_t n){
+  if (!user_range_ok(from, n)){
+    return -EFAULT;
+  }
+  return copy_user(to, from, n);
+}
+
+int copy_to_user(void* to, const void* from, uint32_t n){
+  if (!user_range_ok(to, n)){
+    return -EFAULT;
+  }
+  return copy_user(to, from, n);
+}
+
+int strncpy_from_user(char* dst, const char* src, uint32_t n){
+  // Stop at the kernel half; reading into it would be a fault anyway
+  if ((uint32_t)src >= KERNEL_VIRTUAL_BASE){
+    return -EFAULT;
+  }
+  if (n > KERNEL_VIRTUAL_BASE - (uint32_t)src){
+    n = KERNEL_VIRTUAL_BASE - (uint32_t)src;
+  }
+
+  int res;
+  uint32_t d0, d1, d2, d3;
+  asm volatile("   xorl %[res], %[res]\n"
+	       "5: testl %%ecx, %%ecx\n"
+	       "   jz 6f\n"
+	       "1: movb (%%esi), %%al\n"
+	       "   movb %%al, (%%edi)\n"
+	       "   testb %%al, %%al\n"
+	       "   jz 6f\n"
+	       "   incl %%esi\n"
+	       "   incl %%edi\n"
+	       "   incl %[res]\n"
+	       "   decl %%ecx\n"
+	       "   jmp 5b\n"
+	       "6:\n"
+	       ".section .fixup, \"ax\"\n"
+	       "4: movl %[efault], %[res]\n"
+	       "   jmp 6b\n"
+	       ".previous\n"
+	       ".section __ex_table, \"a\"\n"
+	       "   .long 1b, 4b\n"
+	       ".previous\n"
+	       : [res] "=&d"(res), "=&c"(d0), "=&D"(d1), "=&S"(d2), "=&a"(d3)
+	       : "1"(n), "2"(dst), "3"(src), [efault] "i"(-EFAULT)
+	       : "memory");
+  return res;
+}
+
+uint32_t search_exception_table(uint32_t eip){
+  // Only looked at once a fault is already fatal, so a scan will do
+  for (exception_entry_t* entry = _ex_table_start; entry < _ex_table_end; entry++){
+    if (entry->insn == eip){
+      return entry->fixup;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <kernel/virtio.h>
+#include <kernel/pmm.h>
+#include <kernel/vmm.h>
+#include <kernel/page_ops.h>
+#include <common/inline_assembly.h>
+#include <string.h>
+#include <stdio.h>
+
+// ----------------------------------------
+// Device Setup
+// ----------------------------------------
+
+int virtio_probe(uint16_t device_id, virtio_device_t* dev){
+  if (!pci_find_device(VIRTIO_PCI_VENDOR, device_id, 0xFFFF, &dev->pci)){
+    return 0;
+  }
+
+  uint32_t bar0 = pci_config_read32(&dev->pci, PCI_BAR0);
+  if (!(bar0 & PCI_BAR_IO)){
+    printf("virtio: %x has no I/O BAR\n", device_id);
+    return 0;
+  }
+  dev->iobase = (uint16_t)(bar0 & 0xFFFC);
+
+  // Port I/O, and DMA for the rings
+  uint16_t command = pci_config_read16(&dev->pci, PCI_COMMAND);
+  pci_config_write16(&dev->pci, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  // Reset, then tell it we've seen it and know how to drive it
+  outb(dev->iobase + VIRTIO_REG_STATUS, 0);
+  outb(dev->iobase + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+  outb(dev->iobase + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+  return 1;
+}
+
+uint32_t virtio_negotiate(virtio_device_t* dev, uint32_t wanted){
+  uint32_t features = inl(dev->iobase + VIRTIO_REG_DEVICE_FEATURES) & wanted;
+  outl(dev->iobase + VIRTIO_REG_GUEST_FEATURES, features);
+  return features;
+}
+
+// Descriptors and the available ring come first; the used ring
+// starts on the next page
+static uint32_t vring_used_offset(uint16_t size){
+  uint32_t bytes = (sizeof(vring_desc_t) * size) + sizeof(vring_avail_t) + (sizeof(uint16_t) * (size + 1));
+  return (bytes + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+}
+
+static uint32_t vring_size(uint16_t size){
+  uint32_t bytes = sizeof(vring_used_t) + (sizeof(vring_used_elem_t) * size) + sizeof(uint16_t);
+  return vring_used_offset(size) + ((bytes + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1));
+}
+
+int virtio_setup_queue(virtio_device_t* dev, virtqueue_t* vq, uint16_t index){
+  outw(dev->iobase + VIRTIO_REG_QUEUE_SELECT, index);
+  uint16_t size = inw(dev->iobase + VIRTIO_REG_QUEUE_SIZE);
+  if (size == 0){
+    return 0;
+  }
+
+  // Legacy devices take one page frame number for the whole ring, so
+  // it must be physically contiguous
+  uint32_t ring_bytes = vring_size(size);
+  uint32_t first = alloc_contiguous_frames(ring_bytes / PAGE_SIZE);
+  if (first == (uint32_t)-1){
+    printf("virtio: no room for a %d entry queue\n", size);
+    return 0;
+  }
+  uint8_t* ring = phys_to_virt(first * PAGE_SIZE);
+  for (uint32_t offset = 0; offset < ring_bytes; offset += PAGE_SIZE){
+    clear_page(ring + offset);
+  }
+
+  vq->index = index;
+  vq->size = size;
+  vq->desc = (vring_desc_t*)ring;
+  vq->avail = (vring_avail_t*)(ring + (sizeof(vring_desc_t) * size));
+  vq->used = (vring_used_t*)(ring + vring_used_offset(size));
+  vq->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+  for (uint16_t i = 0; i < size; i++){
+    vq->desc[i].next = i + 1;
+  }
+  vq->free_head = 0;
+  vq->num_free = size;
+  vq->last_used = 0;
+
+  outl(dev->iobase + VIRTIO_REG_QUEUE_PFN, first);
+  return 1;
+}
+
+void virtio_driver_ok(virtio_device_t* dev){
+  uint8_t status = inb(dev->iobase + VIRTIO_REG_STATUS);
+  outb(dev->iobase + VIRTIO_REG_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+}
+
+uint32_t virtio_config_read32(virtio_device_t* dev, uint32_t offset){
+  return inl(dev->iobase + VIRTIO_REG_CONFIG + offset);
+}
+
+void virtio_config_write32(virtio_device_t* dev, uint32_t offset, uint32_t value){
+  outl(dev->iobase + VIRTIO_REG_CONFIG + offset, value);
+}
+
+// ----------------------------------------
+// Queue Operations
+// ----------------------------------------
+
+int32_t virtqueue_add(virtqueue_t* vq, uint32_t phys, uint32_t len, int device_writes){
+  if (vq->num_free == 0){
+    return -1;
+  }
+
+  uint16_t id = vq->free_head;
+  vq->free_head = vq->desc[id].next;
+  vq->num_free--;
+
+  vq->desc[id].addr = phys;
+  vq->desc[id].len = len;
+  vq->desc[id].flags = device_writes ? VRING_DESC_F_WRITE : 0;
+
+  // The entry must be visible before the index that publishes it
+  uint16_t avail_idx = vq->avail->idx;
+  vq->avail->ring[avail_idx % vq->size] = id;
+  asm volatile("" : : : "memory");
+  vq->avail->idx = avail_idx + 1;
+
+  return id;
+}
+
+void virtio_kick(virtio_device_t* dev, virtqueue_t* vq){
+  asm volatile("" : : : "memory");
+  outw(dev->iobase + VIRTIO_REG_QUEUE_NOTIFY, vq->index);
+}
+
+int32_t virtqueue_get_used(virtqueue_t* vq){
+  if (vq->last_used == vq->used->idx){
+    return -1;
+  }
+  asm volatile("" : : : "memory");
+
+  uint16_t id = (uint16_t)vq->used->ring[vq->last_used % vq->size].id;
+  vq->last_used++;
+
+  vq->desc[id].next = vq->free_head;
+  vq->free_head = id;
+  vq->num_free++;
+  return id;
+}
+
+int virtqueue_transfer(virtio_device_t* dev, virtqueue_t* vq, uint32_t phys, uint32_t len, int device_writes){
+  int32_t id = virtqueue_add(vq, phys, len, device_writes);
+  if (id < 0){
+    return 0;
+  }
+  virtio_kick(dev, vq);
+
+  for (uint32_t i = 0; i < VIRTIO_POLL_LIMIT; i++){
+    if (virtqueue_get_used(vq) == id){
+      return 1;
+    }
+  }
+
+  printf("virtio: queue %d timed out\n", vq->index);
+  return -1;
+}
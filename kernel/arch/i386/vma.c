@@ -0,0 +1,292 @@
+#include <kernel/vma.h>
+#include <kernel/vmm.h>
+#include <kernel/kheap.h>
+#include <kernel/paging.h>
+#include <stdio.h>
+
+vma_t* kernel_vmas = 0;
+
+// ------------------------------------
+// Node Allocation
+// ------------------------------------
+
+// The first few regions (kernel image, heap) are set up before
+// the heap exists, so they come from a small static pool
+static vma_t vma_boot_pool[VMA_BOOT_POOL_SIZE];
+static uint32_t vma_boot_pool_used = 0;
+
+static vma_t* alloc_vma(){
+  if (kheap){
+    return (vma_t*)kalloc(sizeof(vma_t), 0, kheap);
+  }
+
+  if (vma_boot_pool_used == VMA_BOOT_POOL_SIZE){
+    printf("ERROR: out of boot VMAs\n");
+    return 0;
+  }
+  return &vma_boot_pool[vma_boot_pool_used++];
+}
+
+static void free_vma(vma_t* vma){
+  // Pool entries are never reused
+  if (vma >= &vma_boot_pool[0] && vma < &vma_boot_pool[VMA_BOOT_POOL_SIZE]){
+    return;
+  }
+  kfree(vma, kheap);
+}
+
+// ------------------------------------
+// AVL Helpers
+// ------------------------------------
+
+static int32_t height(vma_t* node){
+  return node ? node->height : 0;
+}
+
+static void update_height(vma_t* node){
+  int32_t hl = height(node->left);
+  int32_t hr = height(node->right);
+  node->height = ((hl > hr) ? hl : hr) + 1;
+}
+
+static vma_t* rotate_right(vma_t* node){
+  vma_t* pivot = node->left;
+  node->left = pivot->right;
+  pivot->right = node;
+  update_height(node);
+  update_height(pivot);
+  return pivot;
+}
+
+static vma_t* rotate_left(vma_t* node){
+  vma_t* pivot = node->right;
+  node->right = pivot->left;
+  pivot->left = node;
+  update_height(node);
+  update_height(pivot);
+  return pivot;
+}
+
+static vma_t* rebalance(vma_t* node){
+  update_height(node);
+  int32_t balance = height(node->left) - height(node->right);
+
+  // Left heavy
+  if (balance > 1){
+    if (height(node->left->left) < height(node->left->right)){
+      node->left = rotate_left(node->left);
+    }
+    return rotate_right(node);
+  }
+
+  // Right heavy
+  if (balance < -1){
+    if (height(node->right->right) < height(node->right->left)){
+      node->right = rotate_right(node->right);
+    }
+    return rotate_left(node);
+  }
+
+  return node;
+}
+
+static vma_t* insert_node(vma_t* root, vma_t* node){
+  if (!root){
+    return node;
+  }
+
+  if (node->start < root->start){
+    root->left = insert_node(root->left, node);
+  } else {
+    root->right = insert_node(root->right, node);
+  }
+  return rebalance(root);
+}
+
+// Unlink the leftmost node of a subtree, handing it back in *min
+static vma_t* remove_min(vma_t* root, vma_t** min){
+  if (!root->left){
+    *min = root;
+    return root->right;
+  }
+
+  root->left = remove_min(root->left, min);
+  return rebalance(root);
+}
+
+static vma_t* remove_node(vma_t* root, uint32_t start, vma_t** removed){
+  if (!root){
+    return 0;
+  }
+
+  if (start < root->start){
+    root->left = remove_node(root->left, start, removed);
+  } else if (start > root->start){
+    root->right = remove_node(root->right, start, removed);
+  } else {
+    *removed = root;
+    if (!root->left || !root->right){
+      return root->left ? root->left : root->right;
+    }
+
+    // Two children: the in-order successor takes this node's place
+    vma_t* successor;
+    vma_t* right = remove_min(root->right, &successor);
+    successor->left = root->left;
+    successor->right = right;
+    return rebalance(successor);
+  }
+
+  return rebalance(root);
+}
+
+// ------------------------------------
+// Tree Operations
+// ------------------------------------
+
+vma_t* find_vma(vma_t* root, uint32_t addr){
+  while (root){
+    if (addr < root->start){
+      root = root->left;
+    } else if (addr >= root->end){
+      root = root->right;
+    } else {
+      return root;
+    }
+  }
+  return 0;
+}
+
+// Does any region overlap [start, end)? Regions don't overlap each
+// other, so a node wholly to one side of the range rules out that side
+static int overlaps_vma(vma_t* root, uint32_t start, uint32_t end){
+  while (root){
+    if (root->start < end && root->end > start){
+      return 1;
+    }
+    root = (end <= root->start) ? root->left : root->right;
+  }
+  return 0;
+}
+
+vma_t* insert_vma(vma_t** root, uint32_t start, uint32_t end, uint8_t prot, uint8_t flags, VMA_BACKING backing){
+
+  // Regions are page granular and must not overlap
+  start &= 0xFFFFF000;
+  end = (end + PAGE_SIZE - 1) & 0xFFFFF000;
+  if (end <= start || overlaps_vma(*root, start, end)){
+    return 0;
+  }
+
+  vma_t* vma = alloc_vma();
+  if (!vma){
+    return 0;
+  }
+
+  vma->start = start;
+  vma->end = end;
+  vma->prot = prot;
+  vma->flags = flags;
+  vma->backing = backing;
+  vma->left = 0;
+  vma->right = 0;
+  vma->height = 1;
+
+  *root = insert_node(*root, vma);
+  return vma;
+}
+
+void remove_vma(vma_t** root, uint32_t start){
+  vma_t* removed = 0;
+  *root = remove_node(*root, start, &removed);
+  if (removed){
+    free_vma(removed);
+  }
+}
+
+// In-order walk; *cursor is the lowest address not yet known to be taken
+static uint32_t gap_walk(vma_t* node, uint32_t* cursor, uint32_t hi, uint32_t size){
+  if (!node){
+    return 0;
+  }
+
+  uint32_t found = gap_walk(node->left, cursor, hi, size);
+  if (found){
+    return found;
+  }
+
+  uint32_t limit = (node->start < hi) ? node->start : hi;
+  if (limit >= *cursor && (limit - *cursor) >= size){
+    return *cursor;
+  }
+
+  uint32_t taken_end = node->end + ((node->flags & VMA_GUARD) ? PAGE_SIZE : 0);
+  if (taken_end > *cursor){
+    *cursor = taken_end;
+  }
+
+  if (*cursor >= hi){
+    return 0;
+  }
+  return gap_walk(node->right, cursor, hi, size);
+}
+
+uint32_t find_vma_gap(vma_t* root, uint32_t lo, uint32_t hi, uint32_t size){
+  uint32_t cursor = lo;
+  uint32_t found = gap_walk(root, &cursor, hi, size);
+  if (found){
+    return found;
+  }
+
+  // Space after the last region
+  if (cursor < hi && (hi - cursor) >= size){
+    return cursor;
+  }
+  return 0;
+}
+
+vma_t* clone_vma_tree(vma_t* root){
+  if (!root){
+    return 0;
+  }
+
+  vma_t* copy = alloc_vma();
+  if (!copy){
+    return 0;
+  }
+
+  *copy = *root;
+  copy->left = 0;
+  copy->right = 0;
+
+  // All or nothing: a partial copy would leave mapped pages uncovered
+  copy->left = clone_vma_tree(root->left);
+  if (root->left && !copy->left){
+    destroy_vma_tree(copy);
+    return 0;
+  }
+  copy->right = clone_vma_tree(root->right);
+  if (root->right && !copy->right){
+    destroy_vma_tree(copy);
+    return 0;
+  }
+  return copy;
+}
+
+void destroy_vma_tree(vma_t* root){
+  if (!root){
+    return;
+  }
+
+  destroy_vma_tree(root->left);
+  destroy_vma_tree(root->right);
+  free_vma(root);
+}
+
+vma_t* lookup_vma(uint32_t addr){
+  if (addr >= KERNEL_VIRTUAL_BASE){
+    return find_vma(kernel_vmas, addr);
+  }
+
+  return find_vma(get_current_mm()->vmas, addr);
+}
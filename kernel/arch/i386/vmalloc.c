@@ -0,0 +1,50 @@
+#include <kernel/vmalloc.h>
+#include <kernel/vma.h>
+#include <kernel/vmm.h>
+#include <kernel/pmm.h>
+#include <kernel/multitasking.h>
+#include <stdio.h>
+
+void* vmalloc(uint32_t size){
+  if (size == 0){
+    return 0;
+  }
+  size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+
+  lock_scheduler();
+
+  // Room for the region plus its guard page
+  uint32_t start = find_vma_gap(kernel_vmas, VMALLOC_START, VMALLOC_END, size + PAGE_SIZE);
+  vma_t* vma = 0;
+  if (start){
+    vma = insert_vma(&kernel_vmas, start, start + size, VMA_READ | VMA_WRITE, VMA_DEMAND | VMA_GUARD, VMA_ANON);
+  }
+
+  unlock_scheduler();
+
+  if (!vma){
+    printf("vmalloc: no room for %d bytes\n", size);
+    return 0;
+  }
+  return (void*)vma->start;
+}
+
+void vfree(void* addr){
+  uint32_t start = (uint32_t)addr;
+
+  lock_scheduler();
+
+  vma_t* vma = find_vma(kernel_vmas, start);
+  if (!vma || vma->start != start || vma->backing != VMA_ANON || start < VMALLOC_START || start >= VMALLOC_END){
+    unlock_scheduler();
+    printf("vfree: %x is not a vmalloc region\n", start);
+    return;
+  }
+
+  // Release whatever was faulted in
+  unmap_range(vma->start, (vma->end - vma->start) / PAGE_SIZE, MAP_ALLOC);
+
+  remove_vma(&kernel_vmas, start);
+
+  unlock_scheduler();
+}
@@ -1,99 +1,1407 @@
 #include "kernel/vmm.h"
 #include "kernel/pmm.h"
+#include "kernel/multitasking.h"
+#include "kernel/tlb.h"
+#include "kernel/vma.h"
+#include "kernel/kheap.h"
+#include "kernel/boot_heap.h"
+#include "kernel/swap.h"
+#include "kernel/page_ops.h"
 #include <common/inline_assembly.h>
+#include <common/init.h>
+#include <string.h>
+#include <stdio.h>
 
 // -----------------------------------
 // Page Directory -- defined in boot.S
 // -----------------------------------
-extern page_directory_t* boot_page_directory;
+// Also the master copy of the kernel half: every kernel page table
+// is recorded here, and other directories pick it up from here
+// With PAE this is the kernel-half directory itself, which every
+// PDPT points at, and boot_pdpt is the boot task's top level
+extern page_directory_t boot_page_directory;
+#ifdef PAE
+extern pde_t boot_pdpt[];
+#endif
 extern uint32_t kernel_end;
 
+// Address space of the boot task (and of anything without its own)
+mm_t kernel_mm = { 0, 0, 0, 1 };
+static uint32_t num_address_spaces = 1;
+
 // ----------------------------------------------------
 // Memory Manipulation helpers
 // ----------------------------------------------------
 
-page_directory_t* get_page_directory(){
-  return (page_directory_t *)0xFFFFF000;
-}
-
 uint32_t get_pd_index(uint32_t addr){
-  return addr >> 22;
+  return addr >> PDE_SHIFT;
 }
 
 uint32_t get_pt_index(uint32_t addr){
-  return ((addr >> 12) & 0x3FF);
+  return ((addr >> 12) & (PTRS_PER_TABLE - 1));
 }
 
-void * get_pt_physaddr(uint32_t virtualaddr){
-  uint32_t pd_index = get_pd_index(virtualaddr);
-
-  // Get page directory, check whether the PD entry is present.
-  page_directory_t * pd = get_page_directory();
-  uint32_t page_table_phys = (uint32_t)(pd->page_tables[pd_index]);
+// Directories and tables are reached through the direct map, so
+// any of them can be read or edited whether loaded or not
+static uint32_t current_pgdir(){
+  return READ_CR3() & 0xFFFFF000;
+}
 
-  return (void *)page_table_phys;
+// Slot pd_index of the directory (cr3 value) dir_phys
+static pde_t* pde_slot(uint32_t dir_phys, uint32_t pd_index){
+#ifdef PAE
+  pde_t* pdpt = (pde_t*)phys_to_virt(dir_phys);
+  pde_t* pd = (pde_t*)phys_to_virt((uint32_t)(pdpt[pd_index / PTRS_PER_TABLE] & PAGE_FRAME_MASK));
+  return &pd[pd_index % PTRS_PER_TABLE];
+#else
+  page_directory_t* pd = (page_directory_t*)phys_to_virt(dir_phys);
+  return &pd->page_tables[pd_index];
+#endif
 }
 
-void* get_pt_virtaddr(uint32_t pd_index){
-  return (void*)(((uint32_t *)0xFFC00000) + (0x400 * pd_index));
+// Page table behind a directory entry (tables are always in the direct map)
+static page_table_t* pde_to_table(pde_t pde){
+  return (page_table_t*)phys_to_virt((uint32_t)(pde & PAGE_FRAME_MASK));
 }
 
-void * get_physaddr(uint32_t virtualaddr)
+phys_addr_t get_physaddr(uint32_t virtualaddr)
 {
-  uint32_t pd_index = get_pd_index(virtualaddr);
   uint32_t pt_index = get_pt_index(virtualaddr);
 
   // Get page table, make sure it's present
-  uint32_t page_table_phys = (uint32_t)get_pt_physaddr(virtualaddr);
-  if ((page_table_phys & 0x1) == 0){
+  pde_t pde = *pde_slot(current_pgdir(), get_pd_index(virtualaddr));
+  if ((pde & PDE_PRESENT) == 0){
     return 0;
   }
 
+  // Large page (direct map): no table
+  if (pde & PDE_LARGE){
+    return (pde & PAGE_FRAME_MASK & ~(phys_addr_t)(LARGE_PAGE_SIZE - 1)) + (virtualaddr & (LARGE_PAGE_SIZE - 1));
+  }
+
   // Get page table, check whether the PT entry is present.  
-  page_table_t * pt = (page_table_t *)get_pt_virtaddr(pd_index);
+  page_table_t * pt = pde_to_table(pde);
   page_t pte = pt->pages[pt_index];
   if (!pte.present){
     return 0;
   }
 
-  uint32_t base = (pte.frame << 12);
+  phys_addr_t base = ((phys_addr_t)pte.frame << 12);
   uint32_t offset = ((uint32_t)virtualaddr & 0xFFF);
-  return (void *)(base + offset);
+  return base + offset;
+}
+
+phys_addr_t virt_to_phys(void* vaddr){
+  uint32_t addr = (uint32_t)vaddr;
+  if (addr >= DIRECT_MAP_BASE && addr < DIRECT_MAP_END){
+    return addr - DIRECT_MAP_BASE;
+  }
+
+  return get_physaddr(addr);
 }
 
 // ---------------------------------------------------------
 // Paging Logic
 // ---------------------------------------------------------
 
+// boot.S mapped the first 4MB; map the rest of RAM behind it
+static void __init setup_direct_map(){
+
+  uint32_t first_pd = get_pd_index(BOOT_MAPPING_END);
+  uint32_t last_pd = get_pd_index(DIRECT_MAP_END - 1);
+
+#ifndef PAE
+  uint32_t eax, ebx, ecx, edx;
+  CPUID(0x1, &eax, &ebx, &ecx, &edx);
+
+  // No PSE: ordinary tables. Their frames lie above the part that is
+  // already mapped, so fill them through the recursive slot
+  if (!(edx & CPUID_FEAT_EDX_PSE)){
+    for (uint32_t i = first_pd; i <= last_pd; i++){
+      uint32_t table_index = first_frame();
+      if (table_index == (uint32_t)-1){
+	printf("Direct map: out of frames at %x\n", i << PDE_SHIFT);
+	return;
+      }
+
+      *pde_slot(kernel_mm.pgdir, i) = (table_index * PAGE_SIZE) | PDE_PRESENT | PDE_RW;
+      uint32_t* ptes = (uint32_t*)(RECURSIVE_MAP_BASE + (i * PAGE_SIZE));
+      flush_tlb_page((uint32_t)ptes);
+
+      uint32_t phys = (i - KERNEL_PDE_START) << PDE_SHIFT;
+      for (uint32_t j = 0; j < PTRS_PER_TABLE; j++){
+	ptes[j] = (phys + (j * PAGE_SIZE)) | PDE_PRESENT | PDE_RW | PTE_GLOBAL;
+      }
+    }
+    printf("Direct map: %d MB in 4KB pages\n", (DIRECT_MAP_END - DIRECT_MAP_BASE) >> 20);
+    return;
+  }
+
+  WRITE_CR4(READ_CR4() | CR4_PSE);
+#endif // PAE
+
+  // One large page per directory entry, no tables needed
+  // (PAE always has 2MB pages)
+  for (uint32_t i = first_pd; i <= last_pd; i++){
+    uint32_t phys = (i - KERNEL_PDE_START) << PDE_SHIFT;
+    *pde_slot(kernel_mm.pgdir, i) = phys | PDE_PRESENT | PDE_RW | PDE_LARGE | PTE_GLOBAL;
+  }
+  printf("Direct map: %d MB in %d MB pages\n", (DIRECT_MAP_END - DIRECT_MAP_BASE) >> 20, LARGE_PAGE_SIZE >> 20);
+}
+
+static void install_page_table(uint32_t pd_index, uint32_t table_index);
+
+#ifndef PAE
+// Give every kernel-half slot not taken by the direct map its page
+// table now. Tables are never added to the kernel half after boot, so
+// the PDEs copied into a new directory are complete for good: nothing
+// has to be synchronised when the heap or vmalloc grows. (With PAE the
+// kernel half is one shared directory and never needed this)
+static void __init setup_kernel_page_tables(){
+  uint32_t num_tables = 0;
+  for (uint32_t i = KERNEL_PDE_START; i < RECURSIVE_PDE; i++){
+    if (*pde_slot(kernel_mm.pgdir, i) & PDE_PRESENT){
+      continue;
+    }
+
+    uint32_t table_index = first_frame();
+    if (table_index == (uint32_t)-1){
+      printf("Kernel page tables: out of frames at %x\n", i << PDE_SHIFT);
+      return;
+    }
+    install_page_table(i, table_index);
+    num_tables++;
+  }
+  printf("Kernel page tables: %d KB preallocated\n", num_tables * (PAGE_SIZE / 1024));
+}
+#endif // PAE
+
+#ifdef PAE
+// boot.S only gave the boot PDPT its kernel-half directory (and the
+// identity slot, since dropped). Give it empty user-half ones
+static void __init setup_boot_pdpt(){
+  for (uint32_t i = 0; i < KERNEL_PDE_START / PTRS_PER_TABLE; i++){
+    uint32_t pd_index = first_frame();
+    if (pd_index == (uint32_t)-1){
+      printf("PAE: no frame for a boot page directory\n");
+      return;
+    }
+    clear_page(phys_to_virt(pd_index * PAGE_SIZE));
+    boot_pdpt[i] = (pd_index * PAGE_SIZE) | PDE_PRESENT;
+  }
+
+  // PDPT entries are only read on a cr3 load
+  flush_tlb_all();
+}
+#endif // PAE
+
+void __init initialize_paging(){
+
+  // Fastest way to clear and copy pages on this CPU
+  setup_page_ops();
+
+#ifdef PAE
+  kernel_mm.pgdir = virt_to_phys(boot_pdpt);
+  setup_boot_pdpt();
+  printf("PAE paging enabled\n");
+#else
+  kernel_mm.pgdir = virt_to_phys(&boot_page_directory);
+#endif
+  kernel_mm.vmas = 0;
+
+  // Kernel-half translations survive CR3 reloads (task switches)
+  if (enable_global_pages()){
+    printf("Global pages enabled\n");
+  }
+
+  setup_direct_map();
+#ifndef PAE
+  setup_kernel_page_tables();
+#endif
+
+  // Fixed kernel regions; anything else in the kernel half
+  // must be claimed (heap, vmalloc) before it can fault in
+  insert_vma(&kernel_vmas, DIRECT_MAP_BASE, DIRECT_MAP_END, VMA_READ | VMA_WRITE, 0, VMA_FIXED);
+}
+
+// Directory entry for pd_index in the current directory. Kernel-half
+// entries are the same everywhere: their tables all exist from boot
+// (with PAE, the kernel half is one shared directory)
+static pde_t current_pde(uint32_t pd_index){
+  return *pde_slot(current_pgdir(), pd_index);
+}
+
+// Is there a page table (not a large page) behind pd_index?
+static int page_table_present(uint32_t pd_index){
+  pde_t pde = current_pde(pd_index);
+  return (pde & PDE_PRESENT) && !(pde & PDE_LARGE);
+}
+
+// Valid (non-zero) entries in each page table, indexed by the table's
+// frame (tables always live in low memory). Lets unmap_range hand an
+// emptied user-half table back to the PMM
+static uint16_t table_entries[LOWMEM_FRAMES];
+
+static uint16_t* table_count(pde_t pde){
+  return &table_entries[(uint32_t)((pde & PAGE_FRAME_MASK) >> 12)];
+}
+
+// An entry that maps nothing and records nothing
+static inline int pte_none(page_t* page){
+  return *(pte_t*)page == 0;
+}
+
+// A page reclaim pushed out; frame holds the swap slot
+static inline int pte_swapped(page_t* page){
+  return !page->present && (page->avail & PAGE_AVAIL_SWAP);
+}
+
+// Drop a user-half table whose last entry just went. Kernel-half
+// tables are shared with every other directory, so those stay
+static void release_empty_table(uint32_t pd_index, tlb_batch_t* batch){
+  if (pd_index >= KERNEL_PDE_START){
+    return;
+  }
+
+  pde_t* slot = pde_slot(current_pgdir(), pd_index);
+  if (!(*slot & PDE_PRESENT) || (*slot & PDE_LARGE) || *table_count(*slot)){
+    return;
+  }
+
+  uint32_t table_phys = (uint32_t)(*slot & PAGE_FRAME_MASK);
+  *slot = 0;
+
+  // invlpg anywhere in the range also drops the cached directory
+  // entry. The frame can't be handed out again before the caller
+  // flushes the batch: it holds the scheduler lock until then
+  tlb_batch_add(batch, pd_index << PDE_SHIFT);
+  free_phys_frame(table_phys);
+}
+
+// Hook a new page table (frame index) into the current directory
+static void install_page_table(uint32_t pd_index, uint32_t table_index){
+  page_table_t* page_table = (page_table_t*)phys_to_virt(table_index * PAGE_SIZE);
+
+  // User-half tables get the user bit; the PTEs decide the rest
+  uint32_t pde_flags = PDE_PRESENT | PDE_RW;
+  if (pd_index < KERNEL_PDE_START){
+    pde_flags |= PDE_USER;
+  }
+
+  *pde_slot(current_pgdir(), pd_index) = (table_index * PAGE_SIZE) | pde_flags;
+
+  // The frame may hold stale data; start with no entries
+  clear_page(page_table);
+  table_entries[table_index] = 0;
+}
+
 page_t* get_page(uint32_t vaddr, int create){
 
   uint32_t pd_index = get_pd_index(vaddr);
   uint32_t pt_index = get_pt_index(vaddr);
 
-  // Get page directory virtual address (via recursive mapping)
-  page_directory_t* page_directory = get_page_directory();
-  
-  // Get page table physical and virtual address
-  uint32_t page_table_phys = (uint32_t)get_pt_physaddr(vaddr);
-  page_table_t* page_table = (page_table_t*)get_pt_virtaddr(pd_index);
-
-  uint32_t page_table_present = page_table_phys & 0x1;
-  if (!page_table_present){
-    if (create){
-      // Grab an available physical frame (returns index, so mult * 1000)
-      uint32_t new_table_frame = first_frame() * 0x1000;
-      //breakpoint();
-      
-      // Add new page table to the page directory
-      page_directory->page_tables[pd_index] = (page_table_t*)(new_table_frame | 0x3);
-    } else {
+  if (!page_table_present(pd_index)){
+    // Inside a large page (direct map) there is no PTE to hand out
+    if (!create || (current_pde(pd_index) & PDE_LARGE)){
       return 0; // PT not present; not creating
     }
+
+    // Grab an available physical frame
+    uint32_t new_table_index = first_frame();
+    if (new_table_index == (uint32_t)-1){
+      return 0; // Out of physical memory
+    }
+    install_page_table(pd_index, new_table_index);
   }
-  
+
   // Page Table present, get page entry and return as is
   // Return even if not allocated - don't allocate it
-  page_t* page = &(page_table->pages[pt_index]);
-  return page;
-  
+  page_table_t* page_table = pde_to_table(current_pde(pd_index));
+  return &(page_table->pages[pt_index]);
+}
+
+// ---------------------------------------------------------
+// Range Mapping
+// ---------------------------------------------------------
+
+// Frames are grabbed from the PMM this many at a time. The buffers are
+// shared, so every user runs under lock_scheduler()
+#define RANGE_ALLOC_BATCH 64
+static uint32_t range_frames[RANGE_ALLOC_BATCH];
+static uint32_t range_tables[RANGE_ALLOC_BATCH];
+
+// Make sure every page table for directory slots [first_pd, last_pd]
+// exists, allocating the missing ones together
+static int alloc_page_tables(uint32_t first_pd, uint32_t last_pd){
+
+  uint32_t pd_index = first_pd;
+  while (pd_index <= last_pd){
+    uint32_t missing = 0;
+    for (; pd_index <= last_pd && missing < RANGE_ALLOC_BATCH; pd_index++){
+      uint32_t pde = current_pde(pd_index);
+      if (pde & PDE_LARGE){
+	return 0; // Part of the direct map; not ours to remap
+      }
+      if (!(pde & PDE_PRESENT)){
+	range_tables[missing++] = pd_index;
+      }
+    }
+    if (!missing){
+      break;
+    }
+
+    uint32_t got = alloc_frames(range_frames, missing, 0);
+    if (got < missing){
+      for (uint32_t i = 0; i < got; i++){
+	free_phys_frame(range_frames[i] * PAGE_SIZE);
+      }
+      return 0;
+    }
+
+    for (uint32_t i = 0; i < missing; i++){
+      install_page_table(range_tables[i], range_frames[i]);
+    }
+  }
+
+  return 1;
+}
+
+// Low PTE bits for a mapping with the given MAP_* flags
+static uint32_t range_pte_flags(uint32_t vaddr, uint32_t flags){
+  uint32_t pte_flags = PDE_PRESENT;
+  if (flags & MAP_WRITE){
+    pte_flags |= PDE_RW;
+  }
+  if (flags & MAP_USER){
+    pte_flags |= PDE_USER;
+  }
+  if (vaddr >= KERNEL_VIRTUAL_BASE){
+    pte_flags |= PTE_GLOBAL;
+  }
+
+  // PAT index 1 (PWT alone) is write-combining once setup_pat() has run;
+  // index 3 (PCD | PWT) is uncached either way
+  if (flags & MAP_UC){
+    pte_flags |= PTE_PCD | PTE_PWT;
+  } else if (flags & MAP_WC){
+    pte_flags |= PTE_PWT;
+  }
+  return pte_flags;
+}
+
+// Give fresh frames to the not-present entries among num_ptes
+// consecutive PTEs (one table) mapping vaddr onwards
+static int fill_ptes(pte_t* ptes, uint16_t* entries, uint32_t vaddr, uint32_t num_ptes, uint32_t pte_flags, uint32_t flags){
+
+  uint32_t i = 0;
+  while (i < num_ptes){
+    uint32_t missing = 0;
+    for (uint32_t j = i; j < num_ptes && missing < RANGE_ALLOC_BATCH; j++){
+      if (!ptes[j]){
+	missing++;
+      }
+    }
+    if (!missing){
+      break;
+    }
+
+    // Only reached through the new mappings, so high memory will do
+    uint32_t got = alloc_frames(range_frames, missing, 1);
+    uint32_t next = 0;
+    for (; i < num_ptes && next < got; i++){
+      // Mapped, or swapped out: leave it be
+      if (ptes[i]){
+	continue;
+      }
+
+      (*entries)++;
+      ptes[i] = ((pte_t)range_frames[next++] << 12) | pte_flags;
+      if (flags & MAP_ZERO){
+	clear_page((void*)(vaddr + (i * PAGE_SIZE)));
+      }
+    }
+    if (got < missing){
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int map_range(uint32_t vaddr, phys_addr_t paddr, uint32_t num_pages, uint32_t flags){
+
+  vaddr &= 0xFFFFF000;
+  paddr &= PAGE_FRAME_MASK;
+  if (num_pages == 0){
+    return 1;
+  }
+
+  // Stay clear of the recursive mapping (and of wrapping around)
+  if (vaddr >= RECURSIVE_MAP_BASE || num_pages > (RECURSIVE_MAP_BASE - vaddr) / PAGE_SIZE){
+    return 0;
+  }
+
+  uint32_t pte_flags = range_pte_flags(vaddr, flags);
+  uint32_t last_addr = vaddr + ((num_pages - 1) * PAGE_SIZE);
+
+  lock_scheduler();
+
+  if (!alloc_page_tables(get_pd_index(vaddr), get_pd_index(last_addr))){
+    unlock_scheduler();
+    return 0;
+  }
+
+  // Only replaced translations can be cached; new ones never are
+  tlb_batch_t batch;
+  tlb_batch_init(&batch);
+
+  int ok = 1;
+  uint32_t addr = vaddr;
+  uint32_t frame = (uint32_t)(paddr >> 12);
+  uint32_t remaining = num_pages;
+  while (remaining && ok){
+
+    // The rest of this table, or the rest of the range
+    uint32_t pt_index = get_pt_index(addr);
+    uint32_t run = PTRS_PER_TABLE - pt_index;
+    if (run > remaining){
+      run = remaining;
+    }
+    pde_t pde = current_pde(get_pd_index(addr));
+    pte_t* ptes = (pte_t*)pde_to_table(pde) + pt_index;
+    uint16_t* entries = table_count(pde);
+
+    if (flags & MAP_ALLOC){
+      ok = fill_ptes(ptes, entries, addr, run, pte_flags, flags);
+    } else {
+      for (uint32_t i = 0; i < run; i++){
+	if (ptes[i] & PDE_PRESENT){
+	  tlb_batch_add(&batch, addr + (i * PAGE_SIZE));
+	} else if (pte_swapped((page_t*)&ptes[i])){
+	  swap_free_slot((uint32_t)(ptes[i] >> 12));
+	}
+	if (!ptes[i]){
+	  (*entries)++;
+	}
+	ptes[i] = ((pte_t)(frame + i) << 12) | pte_flags;
+      }
+      frame += run;
+    }
+
+    addr += run * PAGE_SIZE;
+    remaining -= run;
+  }
+
+  tlb_batch_flush(&batch);
+  unlock_scheduler();
+
+  return ok;
+}
+
+uint32_t unmap_range(uint32_t vaddr, uint32_t num_pages, uint32_t flags){
+
+  vaddr &= 0xFFFFF000;
+  if (vaddr >= RECURSIVE_MAP_BASE){
+    return 0;
+  }
+  if (num_pages > (RECURSIVE_MAP_BASE - vaddr) / PAGE_SIZE){
+    num_pages = (RECURSIVE_MAP_BASE - vaddr) / PAGE_SIZE;
+  }
+
+  lock_scheduler();
+
+  tlb_batch_t batch;
+  tlb_batch_init(&batch);
+
+  uint32_t num_unmapped = 0;
+  uint32_t addr = vaddr;
+  uint32_t remaining = num_pages;
+  while (remaining){
+    uint32_t pd_index = get_pd_index(addr);
+    uint32_t pt_index = get_pt_index(addr);
+    uint32_t run = PTRS_PER_TABLE - pt_index;
+    if (run > remaining){
+      run = remaining;
+    }
+
+    // No table, nothing mapped: skip the lot
+    if (page_table_present(pd_index)){
+      pde_t pde = current_pde(pd_index);
+      page_t* ptes = &pde_to_table(pde)->pages[pt_index];
+      uint16_t* entries = table_count(pde);
+      for (uint32_t i = 0; i < run; i++){
+	// Swapped out: the slot is all that's left of it
+	if (pte_swapped(&ptes[i])){
+	  swap_free_slot(ptes[i].frame);
+	  ptes[i] = (page_t){ 0 };
+	  (*entries)--;
+	  num_unmapped++;
+	  continue;
+	}
+	if (!ptes[i].present){
+	  continue;
+	}
+
+	if (flags & MAP_ALLOC){
+	  free_frame(&ptes[i]);
+	}
+	ptes[i] = (page_t){ 0 };
+	(*entries)--;
+	tlb_batch_add(&batch, addr + (i * PAGE_SIZE));
+	num_unmapped++;
+      }
+
+      release_empty_table(pd_index, &batch);
+    }
+
+    addr += run * PAGE_SIZE;
+    remaining -= run;
+  }
+
+  tlb_batch_flush(&batch);
+  unlock_scheduler();
+
+  return num_unmapped;
+}
+
+void protect_range(uint32_t vaddr, uint32_t num_pages, uint32_t flags){
+
+  vaddr &= 0xFFFFF000;
+  if (vaddr >= RECURSIVE_MAP_BASE){
+    return;
+  }
+  if (num_pages > (RECURSIVE_MAP_BASE - vaddr) / PAGE_SIZE){
+    num_pages = (RECURSIVE_MAP_BASE - vaddr) / PAGE_SIZE;
+  }
+
+  uint32_t rw = (flags & MAP_WRITE) ? 1 : 0;
+  uint32_t user = (flags & MAP_USER) ? 1 : 0;
+
+  lock_scheduler();
+
+  tlb_batch_t batch;
+  tlb_batch_init(&batch);
+
+  uint32_t addr = vaddr;
+  uint32_t remaining = num_pages;
+  while (remaining){
+    uint32_t pd_index = get_pd_index(addr);
+    uint32_t pt_index = get_pt_index(addr);
+    uint32_t run = PTRS_PER_TABLE - pt_index;
+    if (run > remaining){
+      run = remaining;
+    }
+
+    if (page_table_present(pd_index)){
+      page_t* ptes = &pde_to_table(current_pde(pd_index))->pages[pt_index];
+      for (uint32_t i = 0; i < run; i++){
+	if (!ptes[i].present){
+	  continue;
+	}
+
+	// Copy-on-write pages stay read-only; the write fault grants access
+	uint32_t page_rw = (ptes[i].avail & PAGE_AVAIL_COW) ? 0 : rw;
+	if (ptes[i].rw == page_rw && ptes[i].user == user){
+	  continue;
+	}
+
+	ptes[i].rw = page_rw;
+	ptes[i].user = user;
+	tlb_batch_add(&batch, addr + (i * PAGE_SIZE));
+      }
+    }
+
+    addr += run * PAGE_SIZE;
+    remaining -= run;
+  }
+
+  tlb_batch_flush(&batch);
+  unlock_scheduler();
+}
+
+int map_kernel_page_nolock(uint32_t vaddr, uint32_t frame_index){
+  // Kernel tables all exist from boot, so this never allocates
+  if (vaddr < KERNEL_VIRTUAL_BASE || vaddr >= RECURSIVE_MAP_BASE){
+    return 0;
+  }
+  page_t* page = get_page(vaddr, 0);
+  if (!page || !pte_none(page)){
+    return 0;
+  }
+
+  page->frame = frame_index;
+  page->rw = 1;
+  page->global = 1;
+  page->present = 1;
+
+  flush_tlb_page(vaddr);
+  return 1;
+}
+
+void count_kernel_page(uint32_t vaddr){
+  (*table_count(current_pde(get_pd_index(vaddr))))++;
+}
+
+// ---------------------------------------------------------
+// Demand Paging
+// ---------------------------------------------------------
+
+static uint32_t fault_around_pages = FAULT_AROUND_DEFAULT;
+
+// Faults run with IRQs off, one at a time; keep this off the task stack
+static uint32_t fault_frames[FAULT_AROUND_MAX];
+
+void set_fault_around_pages(uint32_t num_pages){
+  // The window is aligned to its own size, so it must be a power of two
+  if (num_pages == 0 || num_pages > FAULT_AROUND_MAX || (num_pages & (num_pages - 1))){
+    printf("Fault-around must be a power of two, 1 to %d pages\n", FAULT_AROUND_MAX);
+    return;
+  }
+
+  fault_around_pages = num_pages;
+}
+
+static void map_demand_page(vma_t* vma, page_t* page, uint32_t vaddr, uint32_t frame_index, int zeroed){
+  page->frame = frame_index;
+  page->rw = (vma->prot & VMA_WRITE) ? 1 : 0;
+  page->user = (vma->prot & VMA_USER) ? 1 : 0;
+  page->global = (vaddr >= KERNEL_VIRTUAL_BASE);
+  page->present = 1;
+
+  // Anonymous memory and stacks start out zeroed (as grow_task_stack
+  // does); the heap formats its own pages
+  if ((vma->backing == VMA_ANON || vma->backing == VMA_STACK) && !zeroed){
+    clear_page((void*)vaddr);
+  }
+}
+
+int handle_demand_fault(vma_t* vma, uint32_t vaddr){
+
+  uint32_t page_addr = vaddr & 0xFFFFF000;
+  uint32_t start = page_addr;
+  uint32_t end = page_addr + PAGE_SIZE;
+
+  // Fault-around: take the whole aligned window, clipped to the region
+  // An aligned window never straddles two page tables
+  if (vma->backing == VMA_ANON || vma->backing == VMA_HEAP){
+    uint32_t window = fault_around_pages * PAGE_SIZE;
+    start = page_addr & ~(window - 1);
+    end = start + window;
+    if (start < vma->start){
+      start = vma->start;
+    }
+    if (end > vma->end){
+      end = vma->end;
+    }
+  }
+
+  // One walk; the window's PTEs are contiguous in the same table
+  page_t* pages = get_page(start, 1);
+  if (!pages){
+    return 0;
+  }
+  uint32_t num_pages = (end - start) / PAGE_SIZE;
+  uint32_t fault_slot = (page_addr - start) / PAGE_SIZE;
+
+  uint32_t needed = 0;
+  for (uint32_t i = 0; i < num_pages; i++){
+    if (pte_none(&pages[i])){
+      needed++;
+    }
+  }
+  if (!needed){
+    return pages[fault_slot].present;
+  }
+
+  // Anonymous memory takes frames the idle task already zeroed first
+  uint32_t zeroed = (vma->backing == VMA_ANON) ? take_zeroed_frames(fault_frames, needed) : 0;
+  uint32_t got = zeroed;
+  if (got < needed){
+    got += alloc_frames(&fault_frames[got], needed - got, 1);
+  }
+  if (!got){
+    return 0;
+  }
+
+  // The faulting page comes first, in case we came up short
+  uint32_t next = 0;
+  if (pte_none(&pages[fault_slot])){
+    map_demand_page(vma, &pages[fault_slot], page_addr, fault_frames[next], next < zeroed);
+    next++;
+  }
+  for (uint32_t i = 0; i < num_pages && next < got; i++){
+    if (pte_none(&pages[i])){
+      map_demand_page(vma, &pages[i], start + (i * PAGE_SIZE), fault_frames[next], next < zeroed);
+      next++;
+    }
+  }
+  *table_count(current_pde(get_pd_index(start))) += next;
+
+  // Not-present entries are never cached, so nothing else needs invalidating
+  flush_tlb_page(page_addr);
+
+  return pages[fault_slot].present;
+}
+
+int handle_swap_fault(vma_t* vma, uint32_t vaddr){
+
+  page_t* page = get_page(vaddr, 0);
+  if (!page || !pte_swapped(page)){
+    return 0;
+  }
+  uint32_t slot = page->frame;
+
+  // Low memory, so it can be filled through the direct map. May run
+  // reclaim, which only ever touches present entries
+  uint32_t frame = first_frame();
+  if (frame == (uint32_t)-1){
+    return -1;
+  }
+
+  // A slot that won't read back leaves the page swapped: the task gets
+  // a fault, not a frame of garbage
+  if (!swap_read_page(slot, phys_to_virt(frame * PAGE_SIZE))){
+    free_phys_frame(frame * PAGE_SIZE);
+    return -1;
+  }
+
+  // The slot stays as the page's swap cache: if the page is still
+  // clean when next evicted, it need not be written again
+  swap_cache_add(frame, slot);
+
+  *(pte_t*)page = 0;
+  page->frame = frame;
+  page->rw = (vma->prot & VMA_WRITE) ? 1 : 0;
+  page->user = (vma->prot & VMA_USER) ? 1 : 0;
+  page->present = 1;
+  flush_tlb_page(vaddr);
+
+  return 1;
+}
+
+// ---------------------------------------------------------
+// Address Spaces
+// ---------------------------------------------------------
+
+mm_t* get_current_mm(){
+  tcb_t* task = get_current_task();
+  return (task && task->mm) ? task->mm : &kernel_mm;
+}
+
+// Free a directory's own frames (not the tables it points at)
+static void free_page_directory(uint32_t dir_phys){
+#ifdef PAE
+  pde_t* pdpt = (pde_t*)phys_to_virt(dir_phys);
+  for (uint32_t i = 0; i < KERNEL_PDE_START / PTRS_PER_TABLE; i++){
+    if (pdpt[i] & PDE_PRESENT){
+      free_phys_frame((uint32_t)(pdpt[i] & PAGE_FRAME_MASK));
+    }
+  }
+#endif
+  free_phys_frame(dir_phys);
+}
+
+static uint32_t create_page_directory(){
+
+  // The master kernel half must not change under us
+  lock_scheduler();
+
+  uint32_t dir_index = first_frame();
+  if (dir_index == (uint32_t)-1){
+    unlock_scheduler();
+    return 0;
+  }
+  uint32_t dir_phys = dir_index * PAGE_SIZE;
+
+#ifdef PAE
+  // Three private user-half directories, then the shared kernel-half
+  // one. PDPT entries are cached on a cr3 load, so they never change
+  pde_t* pdpt = (pde_t*)phys_to_virt(dir_phys);
+  clear_page(pdpt);
+  for (uint32_t i = 0; i < KERNEL_PDE_START / PTRS_PER_TABLE; i++){
+    uint32_t pd_index = first_frame();
+    if (pd_index == (uint32_t)-1){
+      free_page_directory(dir_phys);
+      unlock_scheduler();
+      return 0;
+    }
+    clear_page(phys_to_virt(pd_index * PAGE_SIZE));
+    pdpt[i] = (pd_index * PAGE_SIZE) | PDE_PRESENT;
+  }
+  pdpt[KERNEL_PDE_START / PTRS_PER_TABLE] = boot_pdpt[KERNEL_PDE_START / PTRS_PER_TABLE];
+#else
+  page_directory_t* new_dir = (page_directory_t*)phys_to_virt(dir_phys);
+
+  // Private user half starts out empty
+  memset(&new_dir->page_tables[0], 0x0, KERNEL_PDE_START * sizeof(pde_t));
+
+  // Kernel half is shared by reference, so kernel-side mappings are
+  // identical in every address space. Every kernel table exists from
+  // boot, so this copy never goes stale
+  memcpy(&new_dir->page_tables[KERNEL_PDE_START],
+	 &boot_page_directory.page_tables[KERNEL_PDE_START],
+	 (RECURSIVE_PDE - KERNEL_PDE_START) * sizeof(pde_t));
+
+  // Recursive slot must point at the new directory itself
+  new_dir->page_tables[RECURSIVE_PDE] = dir_phys | PDE_PRESENT | PDE_RW;
+#endif // PAE
+
+  unlock_scheduler();
+
+  return dir_phys;
+}
+
+static void destroy_page_directory(uint32_t dir_phys);
+
+// Clock hand of the reclaim scan (see Reclaim below)
+static mm_t* clock_mm = &kernel_mm;
+static uint32_t clock_addr = 0;
+
+// Cursor and candidates of the merge scan (see Page Merging below)
+typedef struct merge_candidate {
+  mm_t* mm;             // 0: empty
+  uint32_t vaddr;
+  uint32_t frame;
+  uint32_t hash;
+} merge_candidate_t;
+
+static mm_t* merge_mm = &kernel_mm;
+static uint32_t merge_addr = 0;
+static merge_candidate_t merge_table[MERGE_TABLE_SIZE];
+
+static void link_address_space(mm_t* mm){
+  lock_scheduler();
+  mm->next = kernel_mm.next;
+  kernel_mm.next = mm;
+  num_address_spaces++;
+  unlock_scheduler();
+}
+
+static void unlink_address_space(mm_t* mm){
+  lock_scheduler();
+  for (mm_t* prev = &kernel_mm; prev; prev = prev->next){
+    if (prev->next == mm){
+      prev->next = mm->next;
+      num_address_spaces--;
+      break;
+    }
+  }
+
+  // Don't leave the hand on a dead address space
+  if (clock_mm == mm){
+    clock_mm = &kernel_mm;
+    clock_addr = 0;
+  }
+
+  // Nor the merge scan
+  if (merge_mm == mm){
+    merge_mm = &kernel_mm;
+    merge_addr = 0;
+  }
+  for (uint32_t i = 0; i < MERGE_TABLE_SIZE; i++){
+    if (merge_table[i].mm == mm){
+      merge_table[i].mm = 0;
+    }
+  }
+  unlock_scheduler();
+}
+
+mm_t* create_address_space(){
+  mm_t* mm = (mm_t*)kalloc(sizeof(mm_t), 0, kheap);
+  if (!mm){
+    return 0;
+  }
+
+  mm->pgdir = create_page_directory();
+  mm->vmas = 0;
+  mm->users = 1;
+  if (!mm->pgdir){
+    kfree(mm, kheap);
+    return 0;
+  }
+
+  link_address_space(mm);
+  return mm;
+}
+
+static uint32_t clone_page_directory(){
+
+  // Start from a fresh directory; the kernel half is already shared
+  uint32_t dir_phys = create_page_directory();
+  if (!dir_phys){
+    return 0;
+  }
+
+  lock_scheduler();
+
+  // Not current_pgdir(): a kernel thread runs on a borrowed directory
+  uint32_t src_phys = get_current_mm()->pgdir;
+
+  // Pages we write-protect on our side, invalidated once at the end
+  tlb_batch_t batch;
+  tlb_batch_init(&batch);
+
+  for (uint32_t i = 0; i < KERNEL_PDE_START; i++){
+    pde_t pde = *pde_slot(src_phys, i);
+    if (!(pde & PDE_PRESENT)){
+      continue;
+    }
+
+    // Page tables themselves are never shared, only the frames they map
+    uint32_t pt_index = first_frame();
+    if (pt_index == (uint32_t)-1){
+      tlb_batch_flush(&batch);
+      unlock_scheduler();
+      destroy_page_directory(dir_phys);
+      return 0;
+    }
+    uint32_t pt_phys = pt_index * PAGE_SIZE;
+
+    page_table_t* src_pt = pde_to_table(pde);
+    page_table_t* new_pt = (page_table_t*)phys_to_virt(pt_phys);
+    clear_page(new_pt);
+    table_entries[pt_index] = 0;
+
+    for (uint32_t j = 0; j < PTRS_PER_TABLE; j++){
+      page_t* pte = &src_pt->pages[j];
+
+      // Swapped-out pages are shared through their slot
+      if (pte_swapped(pte)){
+	swap_dup_slot(pte->frame);
+	new_pt->pages[j] = *pte;
+	table_entries[pt_index]++;
+	continue;
+      }
+      if (!pte->present){
+	continue;
+      }
+
+      // Writable pages go read-only on both sides until someone writes
+      if (pte->rw){
+	pte->rw = 0;
+	pte->avail |= PAGE_AVAIL_COW;
+	tlb_batch_add(&batch, (i << PDE_SHIFT) | (j << 12));
+      }
+
+      share_frame(pte);
+      new_pt->pages[j] = *pte;
+      table_entries[pt_index]++;
+    }
+
+    *pde_slot(dir_phys, i) = pt_phys | (pde & 0xFFF);
+  }
+
+  // Our own writable pages just became read-only; drop stale entries
+  tlb_batch_flush(&batch);
+
+  unlock_scheduler();
+
+  return dir_phys;
+}
+
+mm_t* clone_address_space(){
+  mm_t* mm = (mm_t*)kalloc(sizeof(mm_t), 0, kheap);
+  if (!mm){
+    return 0;
+  }
+
+  mm->pgdir = clone_page_directory();
+  if (!mm->pgdir){
+    kfree(mm, kheap);
+    return 0;
+  }
+  mm->users = 1;
+
+  // Same regions as the parent; the pages behind them are shared
+  vma_t* parent_vmas = get_current_mm()->vmas;
+  mm->vmas = clone_vma_tree(parent_vmas);
+  if (parent_vmas && !mm->vmas){
+    destroy_page_directory(mm->pgdir);
+    kfree(mm, kheap);
+    return 0;
+  }
+  link_address_space(mm);
+  return mm;
+}
+
+int handle_cow_fault(uint32_t vaddr){
+
+  page_t* page = get_page(vaddr, 0);
+  if (!page || !page->present || !(page->avail & PAGE_AVAIL_COW)){
+    return 0;
+  }
+
+  uint32_t page_addr = vaddr & 0xFFFFF000;
+
+  // Only copy while someone else still maps the frame. The last
+  // owner just takes the page back as writable
+  if (frame_ref_count(page->frame) > 1){
+    uint32_t new_index = first_frame();
+    if (new_index == (uint32_t)-1){
+      return 0;
+    }
+
+    copy_page(phys_to_virt(new_index * PAGE_SIZE), (void*)page_addr);
+
+    // Drop our reference to the shared frame, switch to the copy
+    free_frame(page);
+    page->frame = new_index;
+  }
+
+  page->avail &= ~PAGE_AVAIL_COW;
+  page->rw = 1;
+  flush_tlb_page(page_addr);
+
+  return 1;
+}
+
+static void destroy_page_directory(uint32_t dir_phys){
+
+  // Never tear down the boot directory (master copy of the kernel half)
+  if (dir_phys == 0 || dir_phys == kernel_mm.pgdir){
+    return;
+  }
+
+  // Can't free the directory we're running on
+  if (current_pgdir() == dir_phys){
+    return;
+  }
+
+  lock_scheduler();
+
+  // Only the user half is private; kernel tables are shared
+  for (uint32_t i = 0; i < KERNEL_PDE_START; i++){
+    pde_t* slot = pde_slot(dir_phys, i);
+    if (!(*slot & PDE_PRESENT)){
+      continue;
+    }
+
+    page_table_t* pt = pde_to_table(*slot);
+    for (uint32_t j = 0; j < PTRS_PER_TABLE; j++){
+      if (pt->pages[j].present){
+	free_frame(&pt->pages[j]);
+      } else if (pte_swapped(&pt->pages[j])){
+	swap_free_slot(pt->pages[j].frame);
+      }
+    }
+
+    free_phys_frame((uint32_t)(*slot & PAGE_FRAME_MASK));
+    *slot = 0;
+  }
+
+  free_page_directory(dir_phys);
+
+  unlock_scheduler();
+}
+
+void destroy_address_space(mm_t* mm){
+  if (!mm || mm == &kernel_mm){
+    return;
+  }
+
+  unlink_address_space(mm);
+  destroy_page_directory(mm->pgdir);
+  destroy_vma_tree(mm->vmas);
+  kfree(mm, kheap);
+}
+
+void get_address_space(mm_t* mm){
+  lock_scheduler();
+  mm->users++;
+  unlock_scheduler();
+}
+
+void put_address_space(mm_t* mm){
+  if (!mm){
+    return;
+  }
+
+  lock_scheduler();
+  uint32_t users = --mm->users;
+  unlock_scheduler();
+
+  if (users == 0){
+    destroy_address_space(mm);
+  }
+}
+
+// ---------------------------------------------------------
+// Reclaim
+// ---------------------------------------------------------
+// A clock hand sweeps the user half of every address space. A page
+// that was accessed since the last sweep gets a second chance (its
+// accessed bit is cleared); one that wasn't is evicted to swap.
+// Dirty pages are written out, clean ones whose swap copy is still
+// current are just dropped
+
+static uint8_t reclaiming = 0;
+
+// Push one cold page out to swap. Returns 1 if its frame was freed
+static int evict_page(mm_t* mm, page_t* page, uint32_t vaddr, tlb_batch_t* batch){
+
+  // Shared copy-on-write frames would have to leave every mapping
+  uint32_t frame = page->frame;
+  if (frame_ref_count(frame) > 1){
+    return 0;
+  }
+
+  // Only anonymous memory can go to swap
+  vma_t* vma = find_vma(mm->vmas, vaddr);
+  if (!vma || vma->backing != VMA_ANON){
+    return 0;
+  }
+
+  // Read it through the direct map, or else through the mapping itself
+  int loaded = (mm->pgdir == current_pgdir());
+  void* contents;
+  if (frame < LOWMEM_FRAMES){
+    contents = phys_to_virt(frame * PAGE_SIZE);
+  } else if (loaded){
+    contents = (void*)vaddr;
+  } else {
+    return 0;
+  }
+
+  uint32_t slot = swap_cache_take(frame);
+
+  // Rewriting a slot other PTEs still point at would corrupt them
+  if (slot && page->dirty && swap_slot_refs(slot) > 1){
+    swap_free_slot(slot);
+    slot = 0;
+  }
+
+  if (!slot || page->dirty){
+    if (!slot){
+      slot = swap_alloc_slot();
+    }
+    if (!slot){
+      return 0; // Swap is full
+    }
+    if (!swap_write_page(slot, contents)){
+      swap_free_slot(slot);
+      return 0; // Device is full
+    }
+  }
+
+  free_frame(page);
+  *(pte_t*)page = ((pte_t)slot << 12) | (PAGE_AVAIL_SWAP << 9);
+
+  // User pages aren't global; other address spaces lost theirs on cr3 load
+  if (loaded){
+    tlb_batch_add(batch, vaddr);
+  }
+
+  return 1;
+}
+
+uint32_t reclaim_pages(uint32_t target){
+
+  // Nowhere to put pages, or already under way further up the stack
+  if (reclaiming || !swap_enabled()){
+    return 0;
+  }
+
+  lock_scheduler();
+  reclaiming = 1;
+
+  tlb_batch_t batch;
+  tlb_batch_init(&batch);
+
+  // Two full sweeps at most: the first may only clear accessed bits
+  uint32_t budget = (2 * num_address_spaces * KERNEL_PDE_START) + 1;
+  uint32_t freed = 0;
+
+  while (freed < target && budget--){
+    uint32_t pd_index = get_pd_index(clock_addr);
+    uint32_t pt_index = get_pt_index(clock_addr);
+
+    pde_t pde = *pde_slot(clock_mm->pgdir, pd_index);
+    if ((pde & PDE_PRESENT) && !(pde & PDE_LARGE)){
+      page_table_t* pt = pde_to_table(pde);
+      for (; pt_index < PTRS_PER_TABLE && freed < target; pt_index++){
+	page_t* page = &pt->pages[pt_index];
+	if (!page->present){
+	  continue;
+	}
+
+	// Second chance
+	if (page->accessed){
+	  page->accessed = 0;
+	  continue;
+	}
+
+	freed += evict_page(clock_mm, page, (pd_index << PDE_SHIFT) | (pt_index << 12), &batch);
+      }
+    } else {
+      pt_index = PTRS_PER_TABLE;
+    }
+
+    // Stopped part-way through a table: resume there next time
+    if (pt_index < PTRS_PER_TABLE){
+      clock_addr = (pd_index << PDE_SHIFT) | (pt_index << 12);
+      break;
+    }
+
+    // Next table; past the user half, the next address space
+    pd_index++;
+    clock_addr = pd_index << PDE_SHIFT;
+    if (pd_index >= KERNEL_PDE_START){
+      clock_mm = clock_mm->next ? clock_mm->next : &kernel_mm;
+      clock_addr = 0;
+    }
+  }
+
+  tlb_batch_flush(&batch);
+
+  reclaiming = 0;
+  unlock_scheduler();
+
+  return freed;
+}
+
+// ---------------------------------------------------------
+// Page Merging
+// ---------------------------------------------------------
+// Each scanned page is hashed and looked up among recent candidates.
+// On a hash match, memcmp decides; identical pages end up sharing the
+// candidate's frame read-only, and the first write to either gets a
+// private copy back (handle_cow_fault). The whole scan holds the
+// scheduler lock, so nothing can write a page between the compare and
+// the write-protect
+
+// FNV-1a over the page's words
+static uint32_t hash_page(const uint32_t* words){
+  uint32_t hash = 2166136261U;
+  for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++){
+    hash = (hash ^ words[i]) * 16777619U;
+  }
+  return hash;
+}
+
+// PTE for vaddr in any address space, 0 if there is no table
+static page_t* lookup_page(mm_t* mm, uint32_t vaddr){
+  pde_t pde = *pde_slot(mm->pgdir, get_pd_index(vaddr));
+  if (!(pde & PDE_PRESENT) || (pde & PDE_LARGE)){
+    return 0;
+  }
+  return &pde_to_table(pde)->pages[get_pt_index(vaddr)];
+}
+
+// Resident anonymous memory we can read through the direct map
+static int page_mergeable(mm_t* mm, page_t* page, uint32_t vaddr){
+  if (!page->present || page->frame >= LOWMEM_FRAMES){
+    return 0;
+  }
+
+  vma_t* vma = find_vma(mm->vmas, vaddr);
+  return vma && vma->backing == VMA_ANON;
+}
+
+// Read-only and copy-on-write from now on. Marked even if already
+// read-only, so protect_range never makes a shared frame writable
+static void share_page(mm_t* mm, page_t* page, uint32_t vaddr, tlb_batch_t* batch){
+  int was_writable = page->rw;
+  page->rw = 0;
+  page->avail |= PAGE_AVAIL_COW;
+
+  // Other address spaces lost their (non-global) entries on cr3 load
+  if (was_writable && mm->pgdir == current_pgdir()){
+    tlb_batch_add(batch, vaddr);
+  }
+}
+
+// Merge one page into an identical candidate, or make it a candidate.
+// Returns 1 if its frame was given up
+static int merge_page(mm_t* mm, page_t* page, uint32_t vaddr, tlb_batch_t* batch){
+  void* contents = phys_to_virt(page->frame * PAGE_SIZE);
+  uint32_t hash = hash_page(contents);
+  merge_candidate_t* candidate = &merge_table[hash % MERGE_TABLE_SIZE];
+
+  if (candidate->mm && candidate->hash == hash){
+    page_t* other = lookup_page(candidate->mm, candidate->vaddr);
+    int valid = other && other->present && other->frame == candidate->frame;
+
+    // Already one frame
+    if (valid && other->frame == page->frame){
+      return 0;
+    }
+
+    if (valid && frame_ref_count(other->frame) < MERGE_MAX_SHARING &&
+	memcmp(contents, phys_to_virt(other->frame * PAGE_SIZE), PAGE_SIZE) == 0){
+      share_page(candidate->mm, other, candidate->vaddr, batch);
+      share_frame(other);
+
+      // Our frame goes (or just our reference, if it was shared too)
+      free_frame(page);
+      page->frame = other->frame;
+      page->rw = 0;
+      page->avail |= PAGE_AVAIL_COW;
+
+      // New frame, so the old translation goes whatever it allowed
+      if (mm->pgdir == current_pgdir()){
+	tlb_batch_add(batch, vaddr);
+      }
+      return 1;
+    }
+  }
+
+  candidate->mm = mm;
+  candidate->vaddr = vaddr;
+  candidate->frame = page->frame;
+  candidate->hash = hash;
+  return 0;
+}
+
+uint32_t merge_pages(uint32_t num_pages){
+
+  lock_scheduler();
+
+  tlb_batch_t batch;
+  tlb_batch_init(&batch);
+
+  // One full sweep at most, however sparse the address spaces are
+  uint32_t budget = num_address_spaces * KERNEL_PDE_START;
+  uint32_t scanned = 0;
+  uint32_t merged = 0;
+
+  while (scanned < num_pages && budget--){
+    uint32_t pd_index = get_pd_index(merge_addr);
+    uint32_t pt_index = get_pt_index(merge_addr);
+
+    pde_t pde = *pde_slot(merge_mm->pgdir, pd_index);
+    if ((pde & PDE_PRESENT) && !(pde & PDE_LARGE)){
+      page_table_t* pt = pde_to_table(pde);
+      for (; pt_index < PTRS_PER_TABLE && scanned < num_pages; pt_index++){
+	uint32_t vaddr = (pd_index << PDE_SHIFT) | (pt_index << 12);
+	page_t* page = &pt->pages[pt_index];
+	if (!page_mergeable(merge_mm, page, vaddr)){
+	  continue;
+	}
+
+	scanned++;
+	merged += merge_page(merge_mm, page, vaddr, &batch);
+      }
+    } else {
+      pt_index = PTRS_PER_TABLE;
+    }
+
+    // Stopped part-way through a table: resume there next time
+    if (pt_index < PTRS_PER_TABLE){
+      merge_addr = (pd_index << PDE_SHIFT) | (pt_index << 12);
+      break;
+    }
+
+    // Next table; past the user half, the next address space
+    pd_index++;
+    merge_addr = pd_index << PDE_SHIFT;
+    if (pd_index >= KERNEL_PDE_START){
+      merge_mm = merge_mm->next ? merge_mm->next : &kernel_mm;
+      merge_addr = 0;
+    }
+  }
+
+  tlb_batch_flush(&batch);
+  unlock_scheduler();
+
+  return merged;
 }
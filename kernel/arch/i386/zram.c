@@ -0,0 +1,217 @@
+#include <kernel/zram.h>
+#include <kernel/lz.h>
+#include <kernel/page_ops.h>
+#include <kernel/vmalloc.h>
+#include <kernel/vmm.h>
+#include <kernel/multitasking.h>
+#include <string.h>
+#include <stdio.h>
+
+#define NO_PAGE 0xFFFF
+
+// Pool page bookkeeping. A page in use holds objects of one class; its
+// free objects are chained through their first two bytes
+typedef struct zram_page {
+  uint16_t next;        // Next page in its class's partial list, or the free list
+  uint16_t free_head;   // First free object, NO_PAGE if full
+  uint16_t used;        // Objects handed out
+  uint8_t size_class;
+} zram_page_t;
+
+// Where each slot's compressed copy lives. length 0: nothing stored,
+// PAGE_SIZE: stored uncompressed
+typedef struct zram_slot {
+  uint16_t page;
+  uint16_t object;
+  uint16_t length;
+} zram_slot_t;
+
+static uint8_t* pool = 0;
+static zram_page_t pool_pages[ZRAM_POOL_PAGES];
+static uint16_t free_pages = NO_PAGE;
+
+// Per class: pages with at least one free object
+static uint16_t class_partial[ZRAM_NUM_CLASSES];
+
+static zram_slot_t slots[SWAP_MAX_SLOTS];
+
+// Compression output; writes run under lock_scheduler()
+static uint8_t scratch[PAGE_SIZE];
+
+// ----------------------------------
+// Pool
+// ----------------------------------
+
+static inline uint32_t class_size(uint32_t size_class){
+  return (size_class + 1) * ZRAM_CLASS_SIZE;
+}
+
+static inline uint8_t* object_addr(uint32_t page, uint32_t object){
+  return pool + (page * PAGE_SIZE) + (object * class_size(pool_pages[page].size_class));
+}
+
+// Grab an object big enough for length bytes. 0 if the pool is full
+static int pool_alloc(uint32_t length, uint16_t* page_out, uint16_t* object_out){
+  uint32_t size_class = (length - 1) / ZRAM_CLASS_SIZE;
+
+  uint16_t page = class_partial[size_class];
+  if (page == NO_PAGE){
+    // Carve a free page into objects of this class
+    page = free_pages;
+    if (page == NO_PAGE){
+      return 0;
+    }
+    free_pages = pool_pages[page].next;
+
+    zram_page_t* zp = &pool_pages[page];
+    zp->size_class = size_class;
+    zp->used = 0;
+    zp->free_head = 0;
+    uint32_t num_objects = PAGE_SIZE / class_size(size_class);
+    for (uint32_t i = 0; i < num_objects; i++){
+      uint16_t next = (i + 1 < num_objects) ? i + 1 : NO_PAGE;
+      memcpy(object_addr(page, i), &next, sizeof(next));
+    }
+
+    zp->next = NO_PAGE;
+    class_partial[size_class] = page;
+  }
+
+  zram_page_t* zp = &pool_pages[page];
+  uint16_t object = zp->free_head;
+  memcpy(&zp->free_head, object_addr(page, object), sizeof(zp->free_head));
+  zp->used++;
+
+  // Full pages leave the partial list (we always take from its head)
+  if (zp->free_head == NO_PAGE){
+    class_partial[size_class] = zp->next;
+    zp->next = NO_PAGE;
+  }
+
+  *page_out = page;
+  *object_out = object;
+  return 1;
+}
+
+static void pool_free(uint16_t page, uint16_t object){
+  zram_page_t* zp = &pool_pages[page];
+  uint32_t size_class = zp->size_class;
+  int was_full = (zp->free_head == NO_PAGE);
+
+  memcpy(object_addr(page, object), &zp->free_head, sizeof(zp->free_head));
+  zp->free_head = object;
+  zp->used--;
+
+  if (was_full){
+    zp->next = class_partial[size_class];
+    class_partial[size_class] = page;
+  }
+
+  // Empty: back to the free list for any class
+  if (zp->used == 0){
+    uint16_t* link = &class_partial[size_class];
+    while (*link != page){
+      link = &pool_pages[*link].next;
+    }
+    *link = zp->next;
+
+    zp->next = free_pages;
+    free_pages = page;
+  }
+}
+
+// ----------------------------------
+// Device
+// ----------------------------------
+
+static void zram_free_page(uint32_t slot){
+  lock_scheduler();
+
+  zram_slot_t* zs = &slots[slot];
+  if (zs->length){
+    pool_free(zs->page, zs->object);
+    zs->length = 0;
+  }
+
+  unlock_scheduler();
+}
+
+static int zram_write_page(uint32_t slot, const void* src){
+  lock_scheduler();
+
+  // Rewriting a slot: its old copy goes first
+  zram_free_page(slot);
+
+  // Incompressible pages are kept whole rather than grow
+  const void* data = scratch;
+  uint32_t length = lz_compress(src, PAGE_SIZE, scratch, ZRAM_MAX_COMPRESSED);
+  if (!length){
+    data = src;
+    length = PAGE_SIZE;
+  }
+
+  zram_slot_t* zs = &slots[slot];
+  if (!pool_alloc(length, &zs->page, &zs->object)){
+    unlock_scheduler();
+    return 0;
+  }
+  // Whole-page objects are page aligned, and so is src
+  uint8_t* object = object_addr(zs->page, zs->object);
+  if (length == PAGE_SIZE){
+    copy_page(object, src);
+  } else {
+    memcpy(object, data, length);
+  }
+  zs->length = length;
+
+  unlock_scheduler();
+  return 1;
+}
+
+static int zram_read_page(uint32_t slot, void* dst){
+  zram_slot_t* zs = &slots[slot];
+  uint8_t* object = object_addr(zs->page, zs->object);
+
+  // Whole-page objects are page aligned
+  if (zs->length == PAGE_SIZE){
+    copy_page(dst, object);
+    return 1;
+  }
+
+  if (lz_decompress(object, zs->length, dst, PAGE_SIZE) != PAGE_SIZE){
+    printf("zram: slot %d is corrupt\n", slot);
+    return 0;
+  }
+  return 1;
+}
+
+static swap_device_t zram_device = { "zram", zram_read_page, zram_write_page, zram_free_page, 0 };
+
+// ----------------------------------
+// Setup
+// ----------------------------------
+
+swap_device_t* setup_zram(){
+
+  // Populate it now: eviction runs when frames have already run out
+  pool = (uint8_t*)vmalloc(ZRAM_POOL_PAGES * PAGE_SIZE);
+  if (!pool || !map_range((uint32_t)pool, 0, ZRAM_POOL_PAGES, MAP_WRITE | MAP_ALLOC)){
+    printf("zram: no memory for the pool\n");
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < ZRAM_POOL_PAGES; i++){
+    pool_pages[i].next = (i + 1 < ZRAM_POOL_PAGES) ? i + 1 : NO_PAGE;
+  }
+  free_pages = 0;
+  for (uint32_t i = 0; i < ZRAM_NUM_CLASSES; i++){
+    class_partial[i] = NO_PAGE;
+  }
+
+  // Slots aren't tied to pool space, so there can be more of them than
+  // the pool could hold uncompressed
+  zram_device.num_slots = SWAP_MAX_SLOTS;
+
+  printf("zram: %d KiB pool\n", ZRAM_POOL_PAGES * (PAGE_SIZE / 1024));
+  return &zram_device;
+}
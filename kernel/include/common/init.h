@@ -0,0 +1,21 @@
+#ifndef _INIT_H
+#define _INIT_H
+
+#include <stdint.h>
+
+// --------------------------------------------------------------
+// Boot-only code and data
+// --------------------------------------------------------------
+// Anything tagged with these is placed in .init.text / .init.data
+// (see linker.ld), and its pages are handed back to the PMM by
+// free_boot_memory() once kernel_main has finished setup.
+// Never call an __init function, or touch __initdata, after that.
+
+#define __init      __attribute__((section(".init.text")))
+#define __initdata  __attribute__((section(".init.data")))
+
+// Section bounds, defined in linker.ld
+extern uint32_t _init_start;
+extern uint32_t _init_end;
+
+#endif // _INIT_H
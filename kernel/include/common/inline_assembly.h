@@ -18,6 +18,34 @@ static inline uint8_t inb(uint16_t port)
     return ret;
 }
 
+static inline void outw(uint16_t port, uint16_t val)
+{
+    asm volatile ( "outw %0, %1" : : "a"(val), "Nd"(port) );
+}
+
+static inline uint16_t inw(uint16_t port)
+{
+    uint16_t ret;
+    asm volatile ( "inw %1, %0"
+                   : "=a"(ret)
+                   : "Nd"(port) );
+    return ret;
+}
+
+static inline void outl(uint16_t port, uint32_t val)
+{
+    asm volatile ( "outl %0, %1" : : "a"(val), "Nd"(port) );
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+    uint32_t ret;
+    asm volatile ( "inl %1, %0"
+                   : "=a"(ret)
+                   : "Nd"(port) );
+    return ret;
+}
+
 static inline void io_wait(void)
 {
     asm volatile ( "jmp 1f\n\t"
@@ -48,6 +76,68 @@ static inline void HLT(void) {
   asm volatile("hlt");
 }
 
+// Enable interrupts and halt. sti holds interrupts off for one more
+// instruction, so none can slip in between a check made under CLI and
+// the hlt
+static inline void STI_HLT(void) {
+  asm volatile("sti\n\thlt" : : : "memory");
+}
+
+// Swap value into *addr and return what was there, in one instruction:
+// nothing on this CPU (an exception included) can land in between
+static inline uint32_t XCHG(volatile uint32_t* addr, uint32_t value) {
+  asm volatile("xchgl %0, %1" : "+r"(value), "+m"(*addr) : : "memory");
+  return value;
+}
+
+// Drop the TLB entry for the page containing addr
+static inline void INVLPG(uint32_t addr) {
+  asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline void CPUID(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+  asm volatile("cpuid"
+	       : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+	       : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t READ_CR2(void) {
+  uint32_t cr2;
+  asm volatile("mov %%cr2, %0" : "=r"(cr2));
+  return cr2;
+}
+
+static inline uint32_t READ_CR3(void) {
+  uint32_t cr3;
+  asm volatile("mov %%cr3, %0" : "=r"(cr3));
+  return cr3;
+}
+
+static inline uint64_t RDMSR(uint32_t msr) {
+  uint32_t lo, hi;
+  asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void WRMSR(uint32_t msr, uint64_t value) {
+  asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+// Write back and invalidate every cache line
+static inline void WBINVD(void) {
+  asm volatile("wbinvd" : : : "memory");
+}
+
+static inline uint32_t READ_CR4(void) {
+  uint32_t cr4;
+  asm volatile("mov %%cr4, %0" : "=r"(cr4));
+  return cr4;
+}
+
+static inline void WRITE_CR4(uint32_t cr4) {
+  asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
 static inline void INT(uint8_t interrupt) {
   asm volatile("int %0"
 	       : /* output */
@@ -0,0 +1,79 @@
+#ifndef _BALLOON_H
+#define _BALLOON_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Legacy virtio-pci device ID of the memory balloon
+#define VIRTIO_BALLOON_DEVICE_ID 0x1002
+
+// Feature bits
+#define BALLOON_F_MUST_TELL_HOST  (1 << 0)
+#define BALLOON_F_STATS_VQ        (1 << 1)
+#define BALLOON_F_DEFLATE_ON_OOM  (1 << 2)
+
+// Queues
+#define BALLOON_QUEUE_INFLATE 0
+#define BALLOON_QUEUE_DEFLATE 1
+#define BALLOON_QUEUE_STATS   2
+
+// Device configuration: pages the host wants, pages we hold
+#define BALLOON_CONFIG_NUM_PAGES 0
+#define BALLOON_CONFIG_ACTUAL    4
+
+// Statistics tags we report
+#define BALLOON_STAT_MEMFREE 4
+#define BALLOON_STAT_MEMTOT  5
+#define BALLOON_STAT_AVAIL   6
+#define BALLOON_NUM_STATS    3
+
+// Frames reported to the host per request
+#define BALLOON_ARRAY_PFNS 256
+
+// Most frames the balloon can hold (all of low memory)
+#define BALLOON_MAX_PAGES  32768
+
+// Frames always left free when inflating, so the balloon never pushes
+// the kernel into reclaim
+#define BALLOON_MIN_FREE   1024
+
+// How often the host's target is checked
+#define BALLOON_POLL_MS    1000
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+typedef struct balloon_stat {
+  uint16_t tag;
+  uint64_t val;
+} __attribute__((packed)) balloon_stat_t;
+
+typedef struct balloon_stats {
+  uint32_t target;         // Pages the host asked for
+  uint32_t held;           // Pages in the balloon now
+  uint32_t inflated;       // Pages ever handed to the host
+  uint32_t deflated;       // Pages ever taken back
+  uint32_t oom_deflated;   // ...of those, under memory pressure
+} balloon_stats_t;
+
+// --------------------------------------------
+// Memory Balloon (virtio-balloon)
+// --------------------------------------------
+// Free frames handed to the hypervisor on request and taken back when
+// it lets go of them, or when we run out of memory (if the host allows
+// it). A kernel task polls the host's target
+
+// Find the device and start the balloon task. Needs multitasking
+void setup_balloon();
+
+// Out of memory: take up to count frames back from the balloon.
+// Returns the number freed (0 unless the host offered deflate-on-OOM)
+uint32_t balloon_deflate_on_oom(uint32_t count);
+
+void get_balloon_stats(balloon_stats_t* stats);
+
+#endif // _BALLOON_H
@@ -7,6 +7,8 @@
 // Module for Kernel Heap Operations
 // ----------------------------------
 
+// End of the higher-half mapping set up in boot.S (first 4MB)
+#define BOOT_MAPPING_END 0xC0400000
 
 
 // ----------------------------------
@@ -18,4 +20,8 @@ void setup_boot_heap();
 uint32_t boot_alloc(uint32_t size, uint32_t align);
 uint32_t boot_alloc_frame();
 
+// Give .init.text/.init.data and the unused tail of the boot heap
+// back to the PMM. Call once, after kernel_main has finished setup
+void free_boot_memory();
+
 #endif // _KHEAP_H
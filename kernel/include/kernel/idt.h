@@ -28,6 +28,7 @@ struct IDT_entry {
 // -----------------------------
 void setup_interrupt_service_routines();
 void setup_page_fault_handler();
+void setup_double_fault_handler();
 
 // ----------------------
 // idt_init() definition
@@ -0,0 +1,52 @@
+#ifndef _IOREMAP_H
+#define _IOREMAP_H
+
+#include <stdint.h>
+#include "kernel/paging.h"
+
+// --------------------------------------------
+// Constant Definitions
+// --------------------------------------------
+
+// CPUID.01h:EDX bit and MSR for the page attribute table
+#define CPUID_FEAT_EDX_PAT (1 << 16)
+#define MSR_PAT            0x277
+
+// PAT memory types
+#define PAT_UC       0x00   // Uncached
+#define PAT_WC       0x01   // Write-combining
+#define PAT_WT       0x04   // Write-through
+#define PAT_WB       0x06   // Write-back
+#define PAT_UC_MINUS 0x07   // Uncached, unless an MTRR says write-combining
+
+// Power-on layout with entry 1 (PWT alone) switched from WT to WC.
+// Entries 4-7 repeat 0-3 (the PTE PAT bit is never set)
+#define PAT_ENTRY(index, type) ((uint64_t)(type) << ((index) * 8))
+#define PAT_LAYOUT (PAT_ENTRY(0, PAT_WB) | PAT_ENTRY(1, PAT_WC) |	\
+		    PAT_ENTRY(2, PAT_UC_MINUS) | PAT_ENTRY(3, PAT_UC) |	\
+		    PAT_ENTRY(4, PAT_WB) | PAT_ENTRY(5, PAT_WC) |	\
+		    PAT_ENTRY(6, PAT_UC_MINUS) | PAT_ENTRY(7, PAT_UC))
+
+// --------------------------------------------
+// Setup
+// --------------------------------------------
+
+// Program the PAT so MAP_WC mappings are write-combining. Returns 1 if
+// the CPU has a PAT; without one, ioremap_wc falls back to uncached
+uint32_t setup_pat();
+
+// --------------------------------------------
+// Device Memory Mappings
+// --------------------------------------------
+
+// Map size bytes of device memory at paddr into the vmalloc range.
+// ioremap is uncached (registers); ioremap_wc is write-combining
+// (framebuffers: stores are gathered and written out in bursts).
+// Returns a pointer with paddr's page offset, or 0
+void* ioremap(phys_addr_t paddr, uint32_t size);
+void* ioremap_wc(phys_addr_t paddr, uint32_t size);
+
+// Remove a mapping made by ioremap / ioremap_wc
+void iounmap(void* addr);
+
+#endif // _IOREMAP_H
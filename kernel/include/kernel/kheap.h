@@ -16,6 +16,7 @@
 
 #define KHEAP_START          0xD0000000
 #define KHEAP_INITIAL_SIZE   0x1000
+#define KHEAP_MAX_SIZE       0x10000000
 #define KHEAP_MAGIC          0xFACEB00C
 
 // -------------------------------------------------------------
@@ -0,0 +1,30 @@
+#ifndef _KSM_H
+#define _KSM_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Default scan rate: pages examined per pass, and the pause between passes
+#define KSM_DEFAULT_PAGES       100
+#define KSM_DEFAULT_INTERVAL_MS 200
+
+// --------------------------------------------
+// Same-Page Merging
+// --------------------------------------------
+// A background kernel task runs merge_pages() (vmm.h) at a set rate,
+// so byte-identical user pages across tasks end up sharing one frame
+
+// Start the scanner task
+void create_merge_task();
+
+// Examine num_pages pages every interval_ms milliseconds. A page count
+// of 0 pauses the scanner
+void set_merge_rate(uint32_t num_pages, uint32_t interval_ms);
+
+// Pages merged since boot (each one a frame saved, until written)
+uint32_t pages_merged();
+
+#endif // _KSM_H
@@ -0,0 +1,38 @@
+#ifndef _LZ_H
+#define _LZ_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Shortest match worth encoding, and the farthest one can look back
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 0xFFFF
+
+// Match finder: one candidate position per hash of 4 input bytes
+#define LZ_HASH_BITS  12
+
+// --------------------------------------------
+// Codec
+// --------------------------------------------
+// A byte-oriented LZ77 format in the style of LZ4. Each sequence is a
+// token (literal count in the high nibble, match length - 4 in the low
+// nibble; 15 means more length bytes follow, each adding up to 255),
+// the literals, then a 2-byte little-endian match offset. The last
+// sequence is literals only. Greedy, single pass, no entropy coding:
+// built for speed on page-sized blocks, not ratio
+
+// Compress len bytes of src into at most max bytes of dst. Returns the
+// compressed size, or 0 if it didn't fit
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t max);
+
+// Expand len bytes of src into at most max bytes of dst. Returns the
+// decompressed size, or -1 if the input is malformed
+int32_t lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t max);
+
+// Round-trip and malformed-input checks (see TEST_kheap)
+void TEST_lz();
+
+#endif // _LZ_H
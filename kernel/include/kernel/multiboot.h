@@ -0,0 +1,45 @@
+#ifndef _MULTIBOOT_H
+#define _MULTIBOOT_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// multiboot_info_t.flags: mmap_addr / mmap_length are valid
+#define MULTIBOOT_INFO_MEM_MAP 0x40
+
+// multiboot_mmap_entry_t.type of usable RAM
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+// Boot information handed over by the loader (only the part we read)
+typedef struct multiboot_info {
+  uint32_t flags;
+  uint32_t mem_lower;     // KiB below 1MB
+  uint32_t mem_upper;     // KiB above 1MB
+  uint32_t boot_device;
+  uint32_t cmdline;
+  uint32_t mods_count;
+  uint32_t mods_addr;
+  uint32_t syms[4];
+  uint32_t mmap_length;   // Bytes of memory map
+  uint32_t mmap_addr;     // Physical address of the first entry
+} __attribute__((packed)) multiboot_info_t;
+
+// One memory map entry. size does not count itself
+typedef struct multiboot_mmap_entry {
+  uint32_t size;
+  uint64_t addr;
+  uint64_t len;
+  uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// Physical address of the boot information (saved by boot.S)
+extern uint32_t multiboot_info;
+
+#endif // _MULTIBOOT_H
@@ -9,13 +9,22 @@
 
 #define TIME_SLICE_LENGTH_MS 100000 // 5 seconds (!)
 
+// Priority levels: 0 is the most urgent. A ready task always runs
+// ahead of every less urgent one
+#define NUM_PRIORITIES       32
+#define PRIORITY_INTERACTIVE 8    // Input handling, latency-sensitive work
+#define PRIORITY_NORMAL      16   // Default for new tasks; run by the fair class (sched_fair.h)
+#define PRIORITY_BATCH       24   // Background work
+#define PRIORITY_IDLE        NUM_PRIORITIES  // Only the idle task: below every queue
+
+// Most retired TCB + stack pairs kept around for new tasks
+#define TASK_POOL_MAX 16
+
 // -----------------
 // Data
 // -----------------
 
 extern tcb_t* curr_tcb;        // "Running" TCB
-extern tcb_t* task_list_head; 
-extern tcb_t* task_list_tail;
 
 extern tcb_t* blocked_tasks;
 extern tcb_t* terminated_tasks;
@@ -26,12 +35,14 @@ extern tcb_t* terminated_tasks;
 
 void initialize_multitasking();
 tcb_t* create_kernel_task(void (*entry_EIP)());
+tcb_t* create_cloned_task(void (*entry_EIP)());
 void switch_to_task(tcb_t* new_task);
 void switch_to_next_task();
 void schedule();
 void schedule_under_lock();
 void block_curr_task(char* msg);
 void unblock_task(tcb_t* task, uint8_t preempt);
+void set_task_priority(tcb_t* task, uint8_t priority);
 void terminate_task();
 
 // ----------------------------------
@@ -46,4 +57,11 @@ void unlock_stuff();
 void dump_lock_info();
 void create_cleanup_task();
 
+// Time spent in the idle task since boot, for utilization figures
+uint64_t get_idle_time_ms();
+
+// Memory is short: free up to target frames held by pooled task stacks.
+// Returns how many were freed
+uint32_t trim_task_pool(uint32_t target);
+
 #endif // _MULTITASKING_H
@@ -0,0 +1,27 @@
+#ifndef _PAGE_OPS_H
+#define _PAGE_OPS_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// CPUID.01h:EDX bit for SSE2 (movnti, sfence)
+#define CPUID_FEAT_EDX_SSE2 (1 << 26)
+
+// --------------------------------------------
+// Whole-Page Operations
+// --------------------------------------------
+// Page-aligned, page-sized zeroing and copying. With SSE2 they use
+// non-temporal stores (movnti, from general registers, so no FPU/SSE
+// state is touched), which bypass the cache instead of evicting
+// everything else from it. Otherwise rep stos / rep movs
+
+// Pick the variant for this CPU. Until then, rep stos / rep movs
+void setup_page_ops();
+
+void clear_page(void* page);
+void copy_page(void* dst, const void* src);
+
+#endif // _PAGE_OPS_H
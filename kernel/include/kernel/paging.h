@@ -9,10 +9,86 @@
 
 #define PAGE_SIZE 0x1000
 
+#ifdef PAE
+
+// PAE (build with -DPAE): 64-bit entries, 512 per table. The four page
+// directories (one per PDPT entry) are indexed as one run of 2048
+// entries: 0-1535 user half (private), 1536-2047 kernel half (one
+// directory, shared by every address space)
+#define PTRS_PER_TABLE   512
+#define NUM_PDES         2048
+#define PDE_SHIFT        21
+#define KERNEL_PDE_START 1536
+#define PAGE_FRAME_MASK  0x000FFFFFFFFFF000ULL
+
+// PAE reaches 36 bits of physical address space
+#define MAX_PHYS_ADDR    0x1000000000ULL
+
+typedef uint64_t pte_t;
+typedef uint64_t pde_t;
+typedef uint64_t phys_addr_t;
+
+#else
+
+// Directory layout: 0-767 user half (private to each address space),
+// 768-1022 kernel half (shared), 1023 maps the directory onto itself
+#define PTRS_PER_TABLE   1024
+#define NUM_PDES         1024
+#define PDE_SHIFT        22
+#define KERNEL_PDE_START 768
+#define RECURSIVE_PDE    1023
+#define PAGE_FRAME_MASK  0xFFFFF000
+
+typedef uint32_t pte_t;
+typedef uint32_t pde_t;
+typedef uint32_t phys_addr_t;
+
+#endif // PAE
+
+// Bytes mapped by one directory entry (a large page, or a whole table)
+#define LARGE_PAGE_SIZE (1 << PDE_SHIFT)
+
+// Low flag bits of a directory / table entry
+#define PDE_PRESENT 0x1
+#define PDE_RW      0x2
+#define PDE_USER    0x4
+#define PTE_PWT     0x8     // Write-through (PAT index bit 0)
+#define PTE_PCD     0x10    // Cache disable (PAT index bit 1)
+#define PDE_LARGE   0x80    // Directory entry maps a large page (CR4.PSE, or PAE)
+#define PTE_GLOBAL  0x100   // Global; for directory entries only with PDE_LARGE
+
+// Start of the shared kernel half of every address space
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+
+// Software bits in page_t.avail
+#define PAGE_AVAIL_COW  0x1   // Read-only because the frame is shared copy-on-write
+#define PAGE_AVAIL_SWAP 0x2   // Not present: the frame field holds a swap slot
+
 // --------------------------------------------
 // Structure Definitions
 // --------------------------------------------
 
+#ifdef PAE
+
+typedef struct page {
+  uint64_t present    : 1;
+  uint64_t rw         : 1;
+  uint64_t user       : 1;
+  uint64_t write_thru : 1;
+  uint64_t cached     : 1;
+  uint64_t accessed   : 1;
+  uint64_t dirty      : 1;
+  uint64_t PAT        : 1;
+  uint64_t global     : 1;
+  uint64_t avail      : 3;
+  uint64_t frame      : 40;
+  uint64_t reserved   : 11;
+  uint64_t nx         : 1;
+
+}__attribute__((packed)) page_t;
+
+#else
+
 typedef struct page {
   uint32_t present    : 1;
   uint32_t rw         : 1;
@@ -28,14 +104,17 @@ typedef struct page {
 
 }__attribute__((packed)) page_t;
 
+#endif // PAE
+
 
 typedef struct page_table {
-  page_t pages[1024];
+  page_t pages[PTRS_PER_TABLE];
 } page_table_t;
 
+// One directory page. Without PAE this is the whole directory; with
+// PAE it is one of the four the PDPT points at
 typedef struct page_directory {
-  // Our actual page_tables lookup structure
-  page_table_t* page_tables[1024];
+  pde_t page_tables[PTRS_PER_TABLE];
 } page_directory_t;
 
 
@@ -0,0 +1,55 @@
+#ifndef _PCI_H
+#define _PCI_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Configuration space registers
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_SUBSYSTEM_ID   0x2E
+#define PCI_INTERRUPT_LINE 0x3C
+
+// Command register bits
+#define PCI_COMMAND_IO     0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_MASTER 0x4   // Device may DMA
+
+// BAR bit 0: I/O space (the rest is the port base)
+#define PCI_BAR_IO         0x1
+
+#define PCI_NO_VENDOR      0xFFFF
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+typedef struct pci_device {
+  uint8_t bus;
+  uint8_t slot;
+  uint8_t func;
+} pci_device_t;
+
+// --------------------------------------------
+// Configuration Space Access
+// --------------------------------------------
+
+uint32_t pci_config_read32(pci_device_t* dev, uint8_t offset);
+uint16_t pci_config_read16(pci_device_t* dev, uint8_t offset);
+void pci_config_write16(pci_device_t* dev, uint8_t offset, uint16_t value);
+
+// Find a function with this vendor and device ID. If subsystem isn't
+// 0xFFFF, its subsystem ID must match too. Returns 1 and fills in dev
+int pci_find_device(uint16_t vendor, uint16_t device, uint16_t subsystem, pci_device_t* dev);
+
+#endif // _PCI_H
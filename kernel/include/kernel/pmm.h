@@ -6,7 +6,10 @@
 #include "kernel/kheap.h"
 
 // ** IMPORTANT ** Physical memory size
+// With PAE this is only low memory (direct-mapped); RAM above it is
+// found through the multiboot memory map (see setup_highmem)
 #define PHYSICAL_MEM_SIZE 0x8000000 // 128MB
+#define LOWMEM_FRAMES (PHYSICAL_MEM_SIZE / FRAME_SIZE)
 #define FRAME_SIZE 0x1000
 
 // ----------------------------------------
@@ -29,7 +32,46 @@ extern uint32_t* frames;
 void alloc_table(page_table_t* page_table, int is_kernel, int is_writeable);
 void alloc_frame(page_t* page, int is_kernel, int is_writeable);
 void free_frame(page_t* page);
+void free_phys_frame(uint32_t frame_addr);
+void share_frame(page_t* page);
+uint32_t frame_ref_count(uint32_t frame_index);
+
+// Frames handed out by index. first_frame() is always low memory,
+// so it can hold page tables and anything else reached through the
+// direct map. alloc_frames() may use high memory if highmem_ok
 uint32_t first_frame();
+uint32_t alloc_frames(uint32_t* frame_indices, uint32_t count, int highmem_ok);
+
+// A free low-memory frame straight from the bitmap, marked used,
+// without reclaiming anything. -1 if none. Call with the scheduler locked
+uint32_t grab_free_frame();
+
+// Lowest run of count free low-memory frames (for device rings and
+// the like), marked used. Returns the first frame index, or -1
+uint32_t alloc_contiguous_frames(uint32_t count);
+
+// Return frames by index, as alloc_frames handed them out
+void free_frames(uint32_t* frame_indices, uint32_t count);
+
+// Frames currently free, low and high memory
+uint32_t count_free_frames();
+
+// Pre-zeroed frames: the idle task clears low-memory frames ahead of
+// time so zero-fill faults can skip clear_page. The pool is handed
+// back first when memory runs out
+#define ZEROED_POOL_SIZE 64
+
+// Zero one more frame for the pool. Returns 0 if there was nothing to
+// do (pool full, or no free frame without reclaiming)
+int zero_idle_frame();
+
+// Take up to count zeroed frames, as alloc_frames would hand them out
+uint32_t take_zeroed_frames(uint32_t* frame_indices, uint32_t count);
 void setup_pmm();
 
+#ifdef PAE
+// Track the RAM above the direct map, from the multiboot memory map
+void setup_highmem();
+#endif
+
 #endif // _PMM_H
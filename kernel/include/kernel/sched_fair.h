@@ -0,0 +1,56 @@
+#ifndef _SCHED_FAIR_H
+#define _SCHED_FAIR_H
+
+#include <stdint.h>
+#include <kernel/task_control_block.h>
+
+// --------------------------------------------
+// Constant Definitions
+// --------------------------------------------
+// The fair class runs every task at PRIORITY_NORMAL (multitasking.h).
+// Instead of taking turns, they share the CPU in proportion to their
+// weights: the task that has had the least weighted run time goes next
+
+// Every runnable task gets a turn within this period...
+#define SCHED_LATENCY_MS         20
+// ...unless that would cut slices below this; then the period stretches.
+// The timer only preempts on a tick, so both are raised to at least one
+// tick and slices are rounded up to whole ticks
+#define SCHED_MIN_GRANULARITY_MS 4
+
+#define NICE_MIN -20
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024
+
+// --------------------------------------------
+// Fair Class
+// --------------------------------------------
+// All of these expect the scheduler to be locked
+
+// Fresh fair state for a new task: nice 0, starting level with the rest
+void fair_init_task(tcb_t* task);
+
+// A task waking up gets at most half a period of credit for the time
+// it slept, so a long sleeper can't hog the CPU to catch up
+void fair_place_task(tcb_t* task);
+
+// Add a ready task to / take it out of the run tree. Other than the
+// running task, it is placed first (fair_place_task)
+void fair_enqueue(tcb_t* task);
+void fair_dequeue(tcb_t* task);
+
+// The task with the least virtual run time, 0 if none is ready
+tcb_t* fair_first();
+
+// Charge the task for the time since it was switched in or last
+// charged. Only fair tasks are charged, but every task's clock restarts
+void fair_update_curr(tcb_t* task);
+
+// How long the task should run before the next pick, in ms
+uint32_t fair_time_slice(tcb_t* task);
+
+// Set the task's nice value (NICE_MIN to NICE_MAX); each step is about
+// 10% more or less CPU than a neighbour
+void set_task_nice(tcb_t* task, int8_t nice);
+
+#endif // _SCHED_FAIR_H
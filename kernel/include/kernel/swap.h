@@ -0,0 +1,57 @@
+#ifndef _SWAP_H
+#define _SWAP_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Most slots any swap device can have (slot 0 is never used, so a
+// swapped-out PTE never holds a zero slot)
+#define SWAP_MAX_SLOTS 4096
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+// A backing store for evicted pages, one page per slot
+typedef struct swap_device {
+  char* name;
+  int (*read_page)(uint32_t slot, void* dst);          // 0 if the slot is unreadable
+  int (*write_page)(uint32_t slot, const void* src);   // 0 if out of space
+  void (*free_page)(uint32_t slot);   // Slot no longer referenced (optional)
+  uint32_t num_slots;   // Including the unused slot 0
+} swap_device_t;
+
+// --------------------------------------------
+// Swap Functions
+// --------------------------------------------
+
+// Bring up the swap device (compressed RAM, see zram.h). Needs vmalloc
+void setup_swap();
+
+// 1 once a swap device is up
+int swap_enabled();
+
+// Slots are reference counted: one per swapped-out PTE, plus one
+// while a resident frame still matches the slot (the swap cache)
+uint32_t swap_alloc_slot();          // 0 if swap is full
+void swap_dup_slot(uint32_t slot);
+void swap_free_slot(uint32_t slot);
+uint32_t swap_slot_refs(uint32_t slot);
+
+int swap_read_page(uint32_t slot, void* dst);          // 0 if the slot is unreadable
+int swap_write_page(uint32_t slot, const void* src);   // 0 if the device is full
+
+// Swap cache: remember that a frame read in from slot is still an
+// exact copy of it, so a clean page can be evicted without a write
+void swap_cache_add(uint32_t frame_index, uint32_t slot);
+
+// Detach the frame's slot (0 if none), handing its reference to the caller
+uint32_t swap_cache_take(uint32_t frame_index);
+
+// The frame is being freed; drop its slot, if any
+void swap_forget_frame(uint32_t frame_index);
+
+#endif // _SWAP_H
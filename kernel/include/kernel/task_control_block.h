@@ -11,6 +11,8 @@ typedef enum task_state {
  TASK_TERMINATED = 4
 } TASK_STATE;
 
+struct mm;
+
 typedef struct TCB {
 
   uint32_t esp;   // 
@@ -18,10 +20,23 @@ typedef struct TCB {
   uint32_t cr3;
   TASK_STATE state;
   uint32_t task_id;
+  struct mm* mm;    // Address space; 0 for kernel threads
+  struct mm* active_mm; // Address space loaded while running; borrowed by kernel threads
+  uint8_t kernel_thread; // Never touches user memory, so runs on any address space
+  uint8_t priority;      // Ready queue level, 0 most urgent (see multitasking.h)
 
   // Linked List pointers
   struct TCB* prev_task;
   struct TCB* next_task;
+
+  // Fair class state (sched_fair.h)
+  uint64_t vruntime;     // Weighted run time, in microseconds at nice 0
+  uint64_t exec_start;   // ms_since_boot() when last switched in or charged
+  uint32_t weight;       // From nice
+  int8_t nice;
+  struct TCB* fair_left;
+  struct TCB* fair_right;
+  int32_t fair_height;
 } tcb_t;
 
 
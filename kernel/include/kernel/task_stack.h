@@ -0,0 +1,46 @@
+#ifndef _TASK_STACK_H
+#define _TASK_STACK_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constant Definitions
+// --------------------------------------------
+
+// Kernel virtual range task stacks are carved out of (just past vmalloc)
+#define TASK_STACK_START 0xF0000000
+#define TASK_STACK_END   0xFF000000
+
+// Most a task stack can grow to. Only the top page is backed up front,
+// the rest is faulted in a page at a time
+#define TASK_STACK_SIZE  0x10000
+
+// Frames kept aside for growing stacks from the double-fault task
+#define TASK_STACK_RESERVE 8
+
+// --------------------------------------------
+// Task Stacks
+// --------------------------------------------
+
+// Point the double fault task at the kernel page directory and install
+// its gate. Call once paging is set up
+void setup_task_stacks();
+
+// Reserve TASK_STACK_SIZE bytes above an unmapped guard page and back
+// the top page. Returns the top of the stack (the initial esp), 0 if
+// out of room or memory
+uint32_t alloc_task_stack();
+
+// Unmap and free a stack, given the top alloc_task_stack returned
+void free_task_stack(uint32_t top);
+
+// Back the page holding addr if it is an unbacked page of a task stack.
+// Returns 1 if it did. For the double-fault handler: it only takes
+// frames from the reserve, and neither locks nor allocates
+int grow_task_stack(uint32_t addr);
+
+// Top the reserve back up, and account for the pages grow_task_stack
+// mapped since the last call. Never from fault context
+void refill_stack_reserve();
+
+#endif // _TASK_STACK_H
@@ -0,0 +1,47 @@
+#ifndef _TLB_H
+#define _TLB_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Past this many pages, one full flush beats a run of invlpg
+#define TLB_FLUSH_ALL_THRESHOLD 32
+#define TLB_BATCH_MAX           TLB_FLUSH_ALL_THRESHOLD
+
+// CPUID.01h:EDX and CR4 bits for global pages
+#define CPUID_FEAT_EDX_PGE (1 << 13)
+#define CR4_PGE            (1 << 7)
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+// Collects the pages touched by a map/unmap sequence so the
+// invalidation can be issued once, at the end
+typedef struct tlb_batch {
+  uint32_t addrs[TLB_BATCH_MAX];
+  uint32_t count;
+  uint8_t overflow;   // Too many pages queued; flush everything instead
+  uint8_t kernel;     // Some queued page is in the (global) kernel half
+} tlb_batch_t;
+
+// --------------------------------------------
+// Invalidation Functions
+// --------------------------------------------
+
+void flush_tlb_page(uint32_t vaddr);
+void flush_tlb_range(uint32_t start, uint32_t end);
+void flush_tlb_all();
+void flush_tlb_global();
+
+// Turn on CR4.PGE if the CPU has it. Returns 1 if enabled
+uint32_t enable_global_pages();
+
+void tlb_batch_init(tlb_batch_t* batch);
+void tlb_batch_add(tlb_batch_t* batch, uint32_t vaddr);
+void tlb_batch_flush(tlb_batch_t* batch);
+
+#endif // _TLB_H
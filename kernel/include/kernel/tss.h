@@ -48,4 +48,7 @@ typedef struct TSS {
 
 extern tss_t context_tss;
 
+// Task the CPU switches to on a double fault (see fault_handlers_as.s)
+extern tss_t double_fault_tss;
+
 #endif // _TSS_H
@@ -7,6 +7,7 @@
 
 // Define terminal writing functions
 void terminal_initialize(void);
+void terminal_map_write_combining(void);
 void terminal_putchar(char c);
 void terminal_write(const char* data, size_t size);
 void terminal_writestring(const char* data);
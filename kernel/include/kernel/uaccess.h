@@ -0,0 +1,45 @@
+#ifndef _UACCESS_H
+#define _UACCESS_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constant Definitions
+// --------------------------------------------
+
+// Returned (negated) when a user pointer is bad
+#define EFAULT 14
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+// Instruction allowed to fault on a user address, and where to resume
+// if it does. The linker gathers these into one table (see linker.ld)
+typedef struct exception_entry {
+  uint32_t insn;
+  uint32_t fixup;
+} exception_entry_t;
+
+// --------------------------------------------
+// User Memory Access
+// --------------------------------------------
+// The pointer is only range checked up front; pages are not walked.
+// A fault the page fault handler can't resolve lands in a fixup that
+// makes the call return -EFAULT
+
+// Copy n bytes from user memory. Returns 0, or -EFAULT
+int copy_from_user(void* to, const void* from, uint32_t n);
+
+// Copy n bytes to user memory. Returns 0, or -EFAULT
+int copy_to_user(void* to, const void* from, uint32_t n);
+
+// Copy a string of at most n bytes, NUL included, from user memory.
+// Returns its length without the NUL (n if there was no NUL in the
+// first n bytes, and then dst isn't terminated), or -EFAULT
+int strncpy_from_user(char* dst, const char* src, uint32_t n);
+
+// Fixup for a fault at eip, 0 if eip isn't allowed to fault
+uint32_t search_exception_table(uint32_t eip);
+
+#endif // _UACCESS_H
@@ -0,0 +1,129 @@
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+#include <stdint.h>
+#include "kernel/pci.h"
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+// Legacy (0.9.5) PCI transport: registers in I/O BAR 0
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES  0x04
+#define VIRTIO_REG_QUEUE_PFN       0x08
+#define VIRTIO_REG_QUEUE_SIZE      0x0C
+#define VIRTIO_REG_QUEUE_SELECT    0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY    0x10
+#define VIRTIO_REG_STATUS          0x12
+#define VIRTIO_REG_ISR             0x13
+#define VIRTIO_REG_CONFIG          0x14   // Device-specific (no MSI-X)
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x1
+#define VIRTIO_STATUS_DRIVER      0x2
+#define VIRTIO_STATUS_DRIVER_OK   0x4
+#define VIRTIO_STATUS_FAILED      0x80
+
+// Descriptor flags
+#define VRING_DESC_F_NEXT  0x1
+#define VRING_DESC_F_WRITE 0x2   // Device writes the buffer
+
+// We poll the used rings; no interrupts please
+#define VRING_AVAIL_F_NO_INTERRUPT 0x1
+
+// Legacy rings: used ring starts on the next page
+#define VRING_ALIGN 0x1000
+
+// Polls of the used ring before a request is given up on
+#define VIRTIO_POLL_LIMIT 10000000
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+typedef struct vring_desc {
+  uint64_t addr;   // Guest-physical
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} __attribute__((packed)) vring_desc_t;
+
+typedef struct vring_avail {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[];
+} __attribute__((packed)) vring_avail_t;
+
+typedef struct vring_used_elem {
+  uint32_t id;
+  uint32_t len;
+} __attribute__((packed)) vring_used_elem_t;
+
+typedef struct vring_used {
+  uint16_t flags;
+  uint16_t idx;
+  vring_used_elem_t ring[];
+} __attribute__((packed)) vring_used_t;
+
+// One split virtqueue. Every request here is a single buffer, so each
+// descriptor stands alone (no chains)
+typedef struct virtqueue {
+  uint16_t index;
+  uint16_t size;
+  volatile vring_desc_t* desc;
+  volatile vring_avail_t* avail;
+  volatile vring_used_t* used;
+  uint16_t free_head;   // Unused descriptors, chained through next
+  uint16_t num_free;
+  uint16_t last_used;   // used->idx we have consumed up to
+} virtqueue_t;
+
+typedef struct virtio_device {
+  pci_device_t pci;
+  uint16_t iobase;
+} virtio_device_t;
+
+// --------------------------------------------
+// Device Setup
+// --------------------------------------------
+
+// Find the legacy virtio device with this PCI device ID, reset it and
+// acknowledge it. Returns 1 and fills in dev
+int virtio_probe(uint16_t device_id, virtio_device_t* dev);
+
+// Accept the wanted features the device offers; returns those accepted
+uint32_t virtio_negotiate(virtio_device_t* dev, uint32_t wanted);
+
+// Allocate and register queue index. 0 on failure
+int virtio_setup_queue(virtio_device_t* dev, virtqueue_t* vq, uint16_t index);
+
+// Queues are set up: let the device go
+void virtio_driver_ok(virtio_device_t* dev);
+
+// Device-specific configuration space
+uint32_t virtio_config_read32(virtio_device_t* dev, uint32_t offset);
+void virtio_config_write32(virtio_device_t* dev, uint32_t offset, uint32_t value);
+
+// --------------------------------------------
+// Queue Operations
+// --------------------------------------------
+
+// Offer one buffer (physical address) to the device. device_writes:
+// the device fills it in rather than reads it. Returns the descriptor
+// ID, or -1 if the queue is full. Call virtio_kick to send
+int32_t virtqueue_add(virtqueue_t* vq, uint32_t phys, uint32_t len, int device_writes);
+void virtio_kick(virtio_device_t* dev, virtqueue_t* vq);
+
+// Take back one buffer the device has finished with: its descriptor
+// ID, or -1 if there is none yet
+int32_t virtqueue_get_used(virtqueue_t* vq);
+
+// Send one buffer and wait for the device to finish with it.
+// Returns 1, 0 if the queue was full (nothing sent), or -1 if it timed
+// out: the device may still use the buffer later
+int virtqueue_transfer(virtio_device_t* dev, virtqueue_t* vq, uint32_t phys, uint32_t len, int device_writes);
+
+#endif // _VIRTIO_H
@@ -0,0 +1,74 @@
+#ifndef _VMA_H
+#define _VMA_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constant Definitions
+// --------------------------------------------
+
+// Access permissions (vma_t.prot)
+#define VMA_READ   0x1
+#define VMA_WRITE  0x2
+#define VMA_USER   0x4
+
+// Behaviour flags (vma_t.flags)
+#define VMA_DEMAND 0x1   // Back pages with fresh frames on first touch
+#define VMA_GUARD  0x2   // Leave an unmapped page next to the region (vmalloc, task stacks)
+
+// Pre-heap pool, for the regions set up before kalloc works
+#define VMA_BOOT_POOL_SIZE 8
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+typedef enum vma_backing {
+  VMA_FIXED = 0,    // Mapped up front (kernel image, scratch slots); never faulted in
+  VMA_ANON  = 1,    // Anonymous zero-fill memory
+  VMA_HEAP  = 2,    // Kernel heap
+  VMA_STACK = 3     // Task stack: grows one page per fault, never swapped
+} VMA_BACKING;
+
+// One virtual range [start, end) with uniform permissions.
+// Regions of an address space are kept in an AVL tree keyed on start;
+// they never overlap, so a lookup is a plain O(log n) descent
+typedef struct vma {
+  uint32_t start;
+  uint32_t end;
+  uint8_t prot;
+  uint8_t flags;
+  VMA_BACKING backing;
+
+  // Tree links
+  struct vma* left;
+  struct vma* right;
+  int32_t height;
+} vma_t;
+
+// --------------------------------------------
+// Data
+// --------------------------------------------
+
+// Regions in the shared kernel half (0xC0000000 and up)
+extern vma_t* kernel_vmas;
+
+// --------------------------------------------
+// Tree Operations
+// --------------------------------------------
+
+vma_t* find_vma(vma_t* root, uint32_t addr);
+vma_t* insert_vma(vma_t** root, uint32_t start, uint32_t end, uint8_t prot, uint8_t flags, VMA_BACKING backing);
+void remove_vma(vma_t** root, uint32_t start);
+
+// First gap of at least size bytes in [lo, hi), 0 if none
+uint32_t find_vma_gap(vma_t* root, uint32_t lo, uint32_t hi, uint32_t size);
+
+// Copy of a whole tree; 0 if root was empty or memory ran out
+vma_t* clone_vma_tree(vma_t* root);
+void destroy_vma_tree(vma_t* root);
+
+// Region covering addr in the kernel half or the current address space
+vma_t* lookup_vma(uint32_t addr);
+
+#endif // _VMA_H
@@ -0,0 +1,26 @@
+#ifndef _VMALLOC_H
+#define _VMALLOC_H
+
+#include <stdint.h>
+
+// --------------------------------------------
+// Constant Definitions
+// --------------------------------------------
+
+// Kernel virtual range handed out by vmalloc and ioremap (just past the heap)
+#define VMALLOC_START 0xE0000000
+#define VMALLOC_END   0xF0000000
+
+// --------------------------------------------
+// Kernel Virtual Range Allocator
+// --------------------------------------------
+
+// Reserve size bytes (rounded up to pages) of kernel virtual space,
+// followed by an unmapped guard page. Pages are faulted in on first
+// touch. Returns 0 if no range is free
+void* vmalloc(uint32_t size);
+
+// Unmap and free a range returned by vmalloc
+void vfree(void* addr);
+
+#endif // _VMALLOC_H
@@ -2,20 +2,78 @@
 #define _VMM_H
 
 #include "kernel/paging.h"
+#include "kernel/pmm.h"
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Low physical RAM is mapped linearly at DIRECT_MAP_BASE: the first
+// 4MB by boot.S, the rest at boot (large pages where available).
+// Page directories and tables are reached through it. With PAE,
+// RAM above it (high memory) is only reachable through mappings
+#define DIRECT_MAP_BASE KERNEL_VIRTUAL_BASE
+#define DIRECT_MAP_END  (DIRECT_MAP_BASE + PHYSICAL_MEM_SIZE)
+
+// Without PAE the recursive slot maps the loaded directory's tables
+// here. Nothing past this point can be mapped either way
+#define RECURSIVE_MAP_BASE 0xFFC00000
+
+// CPUID.01h:EDX and CR4 bits for 4MB pages
+#define CPUID_FEAT_EDX_PSE (1 << 3)
+#define CR4_PSE            (1 << 4)
+
+// Pages evicted per reclaim call when an allocation comes up short
+#define RECLAIM_BATCH 16
+
+// Page merging: pages remembered as merge candidates, and the most
+// mappings one merged frame may have
+#define MERGE_TABLE_SIZE  1024
+#define MERGE_MAX_SHARING 256
+
+// Pages mapped around a demand-paging fault (power of two, <= 64)
+#define FAULT_AROUND_DEFAULT 16
+#define FAULT_AROUND_MAX     64
+
+// Flags for map_range / unmap_range / protect_range
+#define MAP_WRITE 0x1   // Writable
+#define MAP_USER  0x2   // Reachable from ring 3
+#define MAP_ALLOC 0x4   // map: back with fresh frames. unmap: free the frames
+#define MAP_ZERO  0x8   // With MAP_ALLOC: zero-fill the fresh frames
+#define MAP_WC    0x10  // Write-combining (needs setup_pat(), see ioremap.h)
+#define MAP_UC    0x20  // Uncached
+
+// --------------------------------------------
+// Structure Definitions
+// --------------------------------------------
+
+struct vma;
+
+// One address space: a page directory plus the regions of its
+// private user half. The kernel half and its regions are shared
+typedef struct mm {
+  uint32_t pgdir;       // Physical address of the page directory (cr3)
+  struct vma* vmas;     // User-half regions (see vma.h)
+  struct mm* next;      // Every address space, for the reclaim scan
+  uint32_t users;       // Owning task, plus kernel threads borrowing it
+} mm_t;
+
+// Address space of the boot task
+extern mm_t kernel_mm;
 
 // --------------------------------------------
 // Memory Manipulation Functions
 // --------------------------------------------
 
-void * get_pt_physaddr(uint32_t virtualaddr);
-void * get_physaddr(uint32_t virtualaddr);
-page_directory_t* get_page_directory();
+// Physical address behind virtualaddr in the loaded directory, 0 if unmapped
+phys_addr_t get_physaddr(uint32_t virtualaddr);
 
 // --------------------------------------------
 // Paging Functions
 // --------------------------------------------
 
-// Set up environment, page directories. Enable paging
+// Paging is already on (boot.S); enable optional features
+// such as global pages for the kernel half
 void initialize_paging();
 
 // Load new page table directory into cr3
@@ -23,7 +81,96 @@ void switch_page_directory(page_directory_t* newDir);
 
 // Retrieve pointer to the required page
 // (create == 1): If the relevant page table doesn't exist, create it
+// Entries filled in through the returned pointer are not counted in
+// the table's valid-entry total (see unmap_range); prefer map_range
 page_t* get_page(uint32_t address, int create);
 
+// Direct map translation. phys_to_virt is only valid for low RAM;
+// virt_to_phys walks the page tables outside the direct map
+static inline void* phys_to_virt(uint32_t phys_addr){
+  return (void*)(phys_addr + DIRECT_MAP_BASE);
+}
+phys_addr_t virt_to_phys(void* vaddr);
+
+// --------------------------------------------
+// Range Mapping
+// --------------------------------------------
+// Each page table in the range is walked once, missing tables are
+// allocated together, and the TLB is invalidated once at the end
+
+// Map num_pages pages at vaddr onto the frames from paddr up (paddr is
+// ignored with MAP_ALLOC, which only fills unmapped pages). Returns 1
+// on success, 0 when out of memory; pages mapped so far stay mapped
+int map_range(uint32_t vaddr, phys_addr_t paddr, uint32_t num_pages, uint32_t flags);
+
+// Drop every mapping in the range. Pass MAP_ALLOC to hand the frames
+// back to the PMM too. User-half page tables left with no entries are
+// freed as well. Returns the number of pages unmapped
+uint32_t unmap_range(uint32_t vaddr, uint32_t num_pages, uint32_t flags);
+
+// Change the MAP_WRITE / MAP_USER bits of the mapped pages in the range
+void protect_range(uint32_t vaddr, uint32_t num_pages, uint32_t flags);
+
+// Map one writable kernel page onto frame_index, in a table that already
+// exists, without locking or allocating: for paths that can't (the
+// double-fault handler). The table's entry count is left alone, as the
+// code interrupted may be updating it; settle it later, under the lock,
+// with count_kernel_page. Returns 0 if vaddr is already in use
+int map_kernel_page_nolock(uint32_t vaddr, uint32_t frame_index);
+void count_kernel_page(uint32_t vaddr);
+
+// --------------------------------------------
+// Address Spaces
+// --------------------------------------------
+
+// New address space: empty user half, kernel half shared with every
+// other address space. 0 on failure
+mm_t* create_address_space();
+
+// New address space whose user half is a copy-on-write duplicate of
+// the current one. Writable user pages become read-only in both
+// directories and are copied on the first write. 0 on failure
+mm_t* clone_address_space();
+
+// Address space of the running task
+mm_t* get_current_mm();
+
+// Reference counting. A kernel thread borrows whichever address space
+// was loaded before it (lazy TLB), so an exiting task's address space
+// may still be loaded; it is only torn down once the last user puts it
+void get_address_space(mm_t* mm);
+void put_address_space(mm_t* mm);
+
+// Back a not-present page in a demand-paged region. Anonymous and heap
+// regions also get the surrounding fault-around window, from one
+// batched frame allocation. Returns 1 if the page is now mapped
+int handle_demand_fault(struct vma* vma, uint32_t vaddr);
+
+// Size of the fault-around window, in pages (1 disables it)
+void set_fault_around_pages(uint32_t num_pages);
+
+// Bring back a page that reclaim pushed out to swap. Returns 1 if it
+// is mapped again, 0 if vaddr was not swapped out, -1 if out of memory
+// or the slot could not be read back
+int handle_swap_fault(struct vma* vma, uint32_t vaddr);
+
+// Evict up to target cold user pages to swap (clock / second chance
+// over every address space). Returns the number of frames freed
+uint32_t reclaim_pages(uint32_t target);
+
+// Examine up to num_pages resident user pages, carrying on from where
+// the last call stopped. A page identical to one seen earlier is
+// remapped onto that page's frame, copy-on-write. Returns the number
+// of pages merged (see ksm.h for the background scanner)
+uint32_t merge_pages(uint32_t num_pages);
+
+// Resolve a write fault on a copy-on-write page
+// Returns 1 if handled, 0 if the page is not copy-on-write
+int handle_cow_fault(uint32_t vaddr);
+
+// Free the user half (frames and page tables), its regions and the
+// directory itself. Must not be the currently loaded address space
+void destroy_address_space(mm_t* mm);
+
 
 #endif
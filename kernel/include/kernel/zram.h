@@ -0,0 +1,34 @@
+#ifndef _ZRAM_H
+#define _ZRAM_H
+
+#include <stdint.h>
+#include "kernel/paging.h"
+#include "kernel/swap.h"
+
+// --------------------------------------------
+// Constants
+// --------------------------------------------
+
+// Memory set aside for compressed pages, taken at setup. Eviction runs
+// when frames have already run out, so the pool can't grow then
+#define ZRAM_POOL_PAGES 512
+
+// Compressed pages are packed into pool pages of one size class each,
+// sized in steps of ZRAM_CLASS_SIZE up to a whole page
+#define ZRAM_CLASS_SIZE  64
+#define ZRAM_NUM_CLASSES (PAGE_SIZE / ZRAM_CLASS_SIZE)
+
+// Pages that don't compress below this are stored as they are
+#define ZRAM_MAX_COMPRESSED (PAGE_SIZE - (PAGE_SIZE / 4))
+
+// --------------------------------------------
+// Compressed RAM Swap Device
+// --------------------------------------------
+// Swap slots backed by LZ-compressed copies (see lz.h) in a RAM pool.
+// Evicted pages take as much memory as they compress to, and a swap
+// fault costs a decompression rather than I/O
+
+// Set aside the pool (needs vmalloc). Returns the device, or 0
+swap_device_t* setup_zram();
+
+#endif // _ZRAM_H
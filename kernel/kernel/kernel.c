@@ -8,6 +8,12 @@
 #include <kernel/vmm.h>
 #include <kernel/boot_heap.h>
 #include <kernel/kheap.h>
+#include <kernel/swap.h>
+#include <kernel/lz.h>
+#include <kernel/ioremap.h>
+#include <kernel/ksm.h>
+#include <kernel/balloon.h>
+#include <kernel/task_stack.h>
 #include <kernel/ps2controller.h>
 #include <kernel/keyboard.h>
 #include <kernel/PIT_Timer.h>
@@ -72,23 +78,50 @@ void kernel_main(void) {
   // Setup physical memory manager
   setup_pmm();
 
+  // Paging features (global kernel pages)
+  initialize_paging();
+
+#ifdef PAE
+  // RAM past the direct map; needs the direct map for its bitmap
+  setup_highmem();
+#endif
+
   // Set up kernel heap
   setup_kheap();
 
+  // Write-combining for the console (and any later framebuffer)
+  if (setup_pat()){
+    printf("PAT: write-combining available\n");
+  }
+  terminal_map_write_combining();
+
+  // Somewhere to evict pages to when memory runs out
+  setup_swap();
+
   // Run tests
   //TEST_kheap();
+  //TEST_lz();
 
   // Initialize hardware
   initialize_PIT_timer(PIT_OUTPUT_FREQ);
   initialize_ps2_controller();
   initialize_keyboard_state();
 
-  // Multitasking
+  // Multitasking (task stacks grow on fault, see task_stack.h)
+  setup_task_stacks();
   initialize_multitasking();
   create_cleanup_task();
+  create_merge_task();
+
+  // Give memory back to the hypervisor on request (virtio-balloon)
+  setup_balloon();
   for (int i = 0; i < 2; i++){
     create_kernel_task(&test_mt); // TID = 8
   }
+
+  // Setup is done; hand boot-only code/data back to the PMM
+  // Nothing tagged __init / __initdata may be used past this point
+  free_boot_memory();
   
 
   